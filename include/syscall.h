@@ -9,6 +9,7 @@ enum {
     SYS_sbrk,
     SYS_readint,
     SYS_time,
+    SYS_roi_begin,
     SYS_exit = 93,
 	NSYSCALLS
 };
@@ -30,6 +30,10 @@ int sys_readint(void);
 #define time() sys_time()
 long sys_time(void);
 
+// mark the beginning of the region of interest for fast-forwarding
+#define roi_begin() sys_roi_begin()
+void sys_roi_begin(void);
+
 // lib/util.c
 void srand(unsigned int seed);
 int rand(void);
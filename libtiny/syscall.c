@@ -59,3 +59,8 @@ long sys_time(void)
 {
     return (long)syscall(SYS_time, 0, 0, 0, 0, 0);
 }
+
+void sys_roi_begin(void)
+{
+    syscall(SYS_roi_begin, 0, 0, 0, 0, 0);
+}
@@ -0,0 +1,46 @@
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include "alloc_counter.hpp"
+using namespace std;
+
+/**
+ *  The array and nothrow forms of operator new call these two, and the
+ *  default operator delete frees what malloc returns, so replacing them is
+ *  enough to see every allocation. As the standard ones, they call the new
+ *  handler and try again while one is installed.
+ */
+static thread_local size_t allocation_count;
+
+size_t heap_allocations()
+{
+    return allocation_count;
+}
+
+void* operator new(size_t size)
+{
+    allocation_count++;
+    while (true) {
+        if (void *ptr = malloc(size ? size : 1))
+            return ptr;
+        new_handler handler = get_new_handler();
+        if (!handler)
+            throw bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+    allocation_count++;
+    void *ptr;
+    size_t align = max((size_t)alignment, sizeof(void*));
+    while (true) {
+        if (posix_memalign(&ptr, align, size ? size : 1) == 0)
+            return ptr;
+        new_handler handler = get_new_handler();
+        if (!handler)
+            throw bad_alloc();
+        handler();
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <cstddef>
+
+// number of heap allocations made by the calling thread so far, counted by
+// the replaced global operator new
+size_t heap_allocations();
+
+#endif
@@ -1,3 +1,5 @@
+#include <cstring>
+#include <algorithm>
 #include "branch_predictor.hpp"
 using namespace std;
 
@@ -54,3 +56,13 @@ void BranchHistoryTable::feedback(reg_t next_pc, bool taken)
     else if (!taken && bits != 0)
         bits--;
 }
+
+string BranchHistoryTable::get_state() const
+{
+    return string((const char*)bht, sizeof(bht));
+}
+
+void BranchHistoryTable::set_state(const string& state)
+{
+    memcpy(bht, state.data(), min(state.size(), sizeof(bht)));
+}
@@ -1,6 +1,7 @@
 #ifndef BRANCH_PREDICTOR_HPP
 #define BRANCH_PREDICTOR_HPP
 
+#include <string>
 #include "types.hpp"
 
 struct BranchPredictor
@@ -8,6 +9,9 @@ struct BranchPredictor
     virtual const char* get_name() const = 0;
     virtual reg_t predict(reg_t next_pc, reg_t target) const = 0;
     virtual void feedback(reg_t next_pc, bool taken) {};
+    // the tables, for checkpoints
+    virtual std::string get_state() const { return ""; }
+    virtual void set_state(const std::string& state) {}
     virtual ~BranchPredictor() = default;
 };
 
@@ -39,6 +43,8 @@ struct BranchHistoryTable : public BranchPredictor
     const char* get_name() const;
     reg_t predict(reg_t next_pc, reg_t target) const;
     void feedback(reg_t next_pc, bool taken);
+    std::string get_state() const;
+    void set_state(const std::string& state);
 };
 
 #endif
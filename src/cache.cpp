@@ -1,6 +1,18 @@
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <iostream>
 #include "cache.hpp"
+#include "checkpoint.hpp"
 using namespace std;
 
+// the lines evicted by prefetches remembered to count pollution
+#define POLLUTION_ENTRIES   4096
+
+// the context of a cache outside a memory system
+static const AccessContext no_context = {0, 0, false};
+
 static inline int log2(int x)
 {
     int ret = 0;
@@ -9,9 +21,10 @@ static inline int log2(int x)
     return ret;
 }
 
-Cache::Cache(const YAML::Node& config)
+Cache::Cache(const YAML::Node& config, bool non_blocking)
+    : non_blocking(non_blocking)
 {
-    int size, line_size;
+    int size, line_size, mshr_num;
     try {
         name = config["name"].as<string>();
         size = config["size"].as<int>() * 1024;  // KB => Bytes
@@ -20,24 +33,78 @@ Cache::Cache(const YAML::Node& config)
         write_back = config["write_back"].as<bool>(true);
         write_allocate = config["write_allocate"].as<bool>(true);
         hit_cycles = config["hit_cycles"].as<int>();
+        replacement = config["replacement"].as<string>("lru");
+        mshr_num = config["mshrs"].as<int>(8);
     } catch (const YAML::BadConversion&) {
-        printf("cache config error\n");
-        exit(EXIT_FAILURE);
+        throw ConfigError("cache config error");
     }
     S = size / line_size / E;
     s = log2(S);
     b = log2(line_size);
+    context = &no_context;
+    if (non_blocking && mshr_num < 1)
+        throw ConfigError(name + " must have at least 1 MSHR");
+    if (non_blocking)
+        mshr.resize(mshr_num);
 
-    cache_set = new CacheLine*[S];
-    for (int i = 0; i < S; i++)
-        cache_set[i] = new CacheLine[E];
+    touch = insert = &Cache::nothing;
+    if (replacement == "lru") {
+        touch = insert = &Cache::lru_touch;
+        evict = &Cache::lru_evict;
+    } else if (replacement == "plru") {
+        if (E & (E - 1))
+            throw ConfigError("the associativity of " + name + " must be a power of 2 for plru");
+        touch = insert = &Cache::plru_touch;
+        evict = &Cache::plru_evict;
+    } else if (replacement == "srrip" || replacement == "brrip" || replacement == "drrip") {
+        touch = &Cache::rrip_touch;
+        evict = &Cache::rrip_evict;
+        insert = replacement == "srrip" ? &Cache::srrip_insert :
+                 replacement == "brrip" ? &Cache::brrip_insert : &Cache::drrip_insert;
+    } else if (replacement == "fifo") {
+        evict = &Cache::fifo_evict;
+    } else if (replacement == "random") {
+        evict = &Cache::random_evict;
+    } else {
+        throw ConfigError("no replacement policy named " + replacement);
+    }
+    prefetcher = config["prefetcher"] ? make_prefetcher(config["prefetcher"], b) : nullptr;
+
+    // tags, timestamps, ready and set_state first to keep them aligned
+    stride = (E + WAY_ALIGN - 1) / WAY_ALIGN * WAY_ALIGN;
+    size_t line_num = (size_t)S * stride;
+    size_t tags_bytes = line_num * sizeof(uint64_t);
+    size_t timestamps_bytes = evict == &Cache::lru_evict ? line_num * sizeof(uint64_t) : 0;
+    size_t ready_bytes = prefetcher || non_blocking ? line_num * sizeof(uint64_t) : 0;
+    size_t set_state_bytes = evict == &Cache::fifo_evict ? S * sizeof(uint32_t) : 0;
+    size_t state_bytes = evict == &Cache::plru_evict || evict == &Cache::rrip_evict ? line_num : 0;
+    size_t prefetched_bytes = prefetcher ? line_num : 0;
+    storage_size = tags_bytes + timestamps_bytes + ready_bytes + set_state_bytes + state_bytes +
+        prefetched_bytes + line_num;
+    storage = operator new(storage_size, align_val_t(64));
+    uint8_t *p = (uint8_t*)storage;
+    tags = (uint64_t*)p;
+    p += tags_bytes;
+    timestamps = timestamps_bytes ? (uint64_t*)p : nullptr;
+    p += timestamps_bytes;
+    ready = ready_bytes ? (uint64_t*)p : nullptr;
+    p += ready_bytes;
+    set_state = set_state_bytes ? (uint32_t*)p : nullptr;
+    p += set_state_bytes;
+    state = state_bytes ? p : nullptr;
+    p += state_bytes;
+    prefetched = prefetched_bytes ? p : nullptr;
+    p += prefetched_bytes;
+    dirty = p;
+    if (prefetcher)
+        pollution.resize(POLLUTION_ENTRIES);
+    invalidate();
 }
 
 Cache::~Cache()
 {
-    for (int i = 0; i < S; i++)
-        delete[] cache_set[i];
-    delete[] cache_set;
+    operator delete(storage, align_val_t(64));
+    delete prefetcher;
 }
 
 string Cache::get_name() const
@@ -55,99 +122,415 @@ void Cache::set_next(Storage *st)
     next = st;
 }
 
+Storage* Cache::get_next() const
+{
+    return next;
+}
+
+void Cache::set_context(const AccessContext *ctx)
+{
+    context = ctx;
+}
+
+// also starts the replacement state afresh, so that every run is the same
 void Cache::invalidate()
 {
     hit_num = miss_num = 0;
-    for (int i = 0; i < S; i++)
-        for (int j = 0; j < E; j++)
-            cache_set[i][j].valid = false;
+    memset(storage, 0, storage_size);
+    for (size_t i = 0; i < (size_t)S * stride; i++)
+        tags[i] = (int)(i % stride) < E ? INVALID_TAG : PADDING_TAG;
+    time = 0;
+    random_state = 0x9E3779B97F4A7C15ULL;
+    brrip_count = 0;
+    psel = (PSEL_MAX + 1) / 2;
+    prefetch_issued = prefetch_useful = prefetch_late = prefetch_polluting = 0;
+    if (prefetcher) {
+        prefetcher->reset();
+        fill(pollution.begin(), pollution.end(), 0);
+    }
+    mshr_merged = mshr_stall_cycles = 0;
+    fill(mshr.begin(), mshr.end(), 0);
 }
 
-Cache::CacheLine* Cache::get_cache_line(uintptr_t ptr)
+void Cache::reset_timing()
 {
-    auto set = cache_set[(ptr >> b) & (S - 1)];
-    uint64_t tag = ptr >> (b + s);
-    CacheLine *evict = nullptr;
-    for (int i = 0; i < E; i++)
-        if (set[i].valid && set[i].tag == tag) {
-            return set + i;
-        } else {
-            if (!evict || !set[i].valid ||
-                time - set[i].timestamp > time - evict->timestamp)
-                evict = set + i;
-        }
-    return evict;
+    if (ready)
+        memset(ready, 0, (size_t)S * stride * sizeof(uint64_t));
+    fill(mshr.begin(), mshr.end(), 0);
 }
 
-int Cache::read(uintptr_t ptr)
+int Cache::lru_evict(size_t set, size_t first)
 {
-    time++;
-    uint64_t tag = ptr >> (b + s);
-    auto line = get_cache_line(ptr);
-    if (line->valid && line->tag == tag) {
-        // read hit
-        hit_num++;
-        line->timestamp = time;
-        return hit_cycles;
+    return lru_victim(first, E);
+}
+
+/**
+ *  Tree PLRU: node i of the set has children 2i and 2i+1, and the leaves
+ *  E..2E-1 are the ways. A node points to the child to go to for the
+ *  victim, and an access points the nodes on its path away from it.
+ */
+void Cache::plru_touch(size_t set, size_t first, int way)
+{
+    for (int node = way + E; node > 1; node >>= 1)
+        state[first + node / 2] = !(node & 1);
+}
+
+int Cache::plru_evict(size_t set, size_t first)
+{
+    int node = 1;
+    while (node < E)
+        node = 2 * node + state[first + node];
+    return node - E;
+}
+
+void Cache::rrip_touch(size_t set, size_t first, int way)
+{
+    state[first + way] = 0;
+}
+
+// the first line predicted to be re-referenced furthest, after ageing all
+// lines until one reaches RRPV_MAX
+int Cache::rrip_evict(size_t set, size_t first)
+{
+    int way = 0;
+    for (int i = 1; i < E; i++)
+        if (state[first + i] > state[first + way])
+            way = i;
+    uint8_t age = RRPV_MAX - state[first + way];
+    for (int i = 0; age && i < E; i++)
+        state[first + i] += age;
+    return way;
+}
+
+void Cache::srrip_insert(size_t set, size_t first, int way)
+{
+    state[first + way] = RRPV_MAX - 1;
+}
+
+void Cache::brrip_insert(size_t set, size_t first, int way)
+{
+    state[first + way] = ++brrip_count % BRRIP_PERIOD == 0 ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+// an insertion follows a miss, which the leader sets count in psel
+void Cache::drrip_insert(size_t set, size_t first, int way)
+{
+    bool brrip;
+    switch (set % DUEL_PERIOD) {
+    case 0:
+        psel += psel < PSEL_MAX;
+        brrip = false;
+        break;
+    case 1:
+        psel -= psel > 0;
+        brrip = true;
+        break;
+    default:
+        brrip = psel > PSEL_MAX / 2;
     }
-    miss_num++;
-    int cycles = hit_cycles;
-    if (write_back && line->valid && line->dirty)
-        cycles += next->write((line->tag << (b + s)) | (ptr & ((S - 1) << b)));
-    cycles += next->read(ptr);
-    line->valid = true;
-    line->dirty = false;
-    line->timestamp = time;
-    line->tag = tag;
-    return cycles;
+    if (brrip)
+        brrip_insert(set, first, way);
+    else
+        srrip_insert(set, first, way);
+}
+
+// ways are filled in order while the set has invalid ones, then replaced
+// in the same order
+int Cache::fifo_evict(size_t set, size_t first)
+{
+    int way = set_state[set];
+    set_state[set] = (way + 1) % E;
+    return way;
+}
+
+int Cache::random_evict(size_t set, size_t first)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state % E;
+}
+
+int Cache::read(uintptr_t ptr)
+{
+    return access<false, DynamicShape>(ptr, *next);
 }
 
 int Cache::write(uintptr_t ptr)
+{
+    return access<true, DynamicShape>(ptr, *next);
+}
+
+/**
+ *  A demand hit on `line`. The first use of a prefetched line counts it
+ *  useful, and late if its data has not arrived yet, which the access
+ *  waits for.
+ */
+int Cache::prefetch_hit(uintptr_t ptr, size_t line, uint64_t now)
+{
+    if (!prefetched[line]) {
+        prefetch(ptr, ACCESS_HIT, now);
+        return 0;
+    }
+    prefetched[line] = false;
+    prefetch_useful++;
+    int wait = 0;
+    if (ready[line] > now) {
+        prefetch_late++;
+        wait = ready[line] - now;
+    }
+    prefetch(ptr, ACCESS_PREFETCH_HIT, now);
+    return wait;
+}
+
+// a demand miss, which a prefetch caused if it evicted the line
+void Cache::prefetch_miss(uintptr_t ptr, uint64_t now)
+{
+    uint64_t entry = (ptr >> b) + 1;  // 0 is empty
+    uint64_t& evicted = pollution[(ptr >> b) % POLLUTION_ENTRIES];
+    if (evicted == entry) {
+        prefetch_polluting++;
+        evicted = 0;
+    }
+    prefetch(ptr, ACCESS_MISS, now);
+}
+
+/**
+ *  Bring the lines predicted after an access to `ptr` into the cache. A
+ *  prefetch fills a line like a miss, but off the path of the access: it
+ *  adds no cycles to it, and its data arrives when the next level would
+ *  have returned it. In non-blocking mode a prefetch takes an MSHR, and is
+ *  dropped if none is free.
+ */
+void Cache::prefetch(uintptr_t ptr, PrefetchTrigger trigger, uint64_t now)
+{
+    uintptr_t lines[MAX_PREFETCH_DEGREE];
+    int n = prefetcher->predict(ptr, context->pc, trigger, lines);
+    for (int i = 0; i < n; i++) {
+        uintptr_t addr = lines[i];
+        size_t set = (addr >> b) & (S - 1), first = set * stride;
+        uint64_t tag = addr >> (b + s);
+        if (find_tag(tags + first, stride, tag) >= 0)
+            continue;
+        auto entry = min_element(mshr.begin(), mshr.end());
+        if (non_blocking && *entry > now)
+            continue;
+        prefetch_issued++;
+        time++;
+        int way = find_tag(tags + first, stride, INVALID_TAG);
+        if (way < 0)
+            way = (this->*evict)(set, first);
+        size_t line = first + way;
+        if (tags[line] != INVALID_TAG) {
+            uintptr_t victim = (tags[line] << (b + s)) | (set << b);
+            uint64_t start = now;
+            if (write_back && dirty[line] && non_blocking)
+                next->write_at(victim, start);
+            else if (write_back && dirty[line])
+                next->write(victim);
+            pollution[(victim >> b) % POLLUTION_ENTRIES] = (victim >> b) + 1;
+        }
+        uint64_t& evicted = pollution[(addr >> b) % POLLUTION_ENTRIES];
+        if (evicted == (addr >> b) + 1)
+            evicted = 0;
+        tags[line] = tag;
+        dirty[line] = false;
+        (this->*insert)(set, first, way);
+        prefetched[line] = true;
+        if (non_blocking) {
+            uint64_t start = now + hit_cycles;
+            ready[line] = *entry = next->read_at(addr, start);
+        } else {
+            ready[line] = now + next->read(addr);
+        }
+    }
+}
+
+/**
+ *  An access in non-blocking mode. A miss takes an MSHR until its data
+ *  arrives, waiting for the first one to be free if all are busy, and
+ *  fills the line at once with the cycle its data arrives. Accesses to the
+ *  line before then are secondary misses merged into the MSHR, counted as
+ *  misses, and done when the data arrives. Write-backs and write-throughs go to the next
+ *  level in the background.
+ */
+template <bool is_write>
+uint64_t Cache::timed_access(uintptr_t ptr, uint64_t& now)
 {
     time++;
+    size_t set = (ptr >> b) & (S - 1), first = set * stride;
     uint64_t tag = ptr >> (b + s);
-    auto line = get_cache_line(ptr);
-    if (line->valid && line->tag == tag) {
-        // write hit
-        hit_num++;
-        line->dirty = true;
-        line->timestamp = time;
-        int cycles = hit_cycles;
-        if (!write_back)
-            cycles += next->write(ptr);
-        return cycles;
+    int way = find_tag(tags + first, stride, tag);
+    if (way >= 0) {
+        size_t line = first + way;
+        (this->*touch)(set, first, way);
+        uint64_t done = now + hit_cycles;
+        if (ready[line] > now) {
+            miss_num++;
+            mshr_merged++;
+            done = max(done, ready[line]);
+        } else {
+            hit_num++;
+        }
+        if (prefetcher)
+            prefetch_hit(ptr, line, now);
+        if (is_write) {
+            dirty[line] = true;
+            uint64_t start = now;
+            if (!write_back)
+                next->write_at(ptr, start);
+        }
+        return done;
     }
+
     miss_num++;
-    if (!write_allocate)
-        return next->write(ptr);
-    int cycles = hit_cycles;
-    if (write_back && line->valid && line->dirty)
-        cycles += next->write((line->tag << (b + s)) | (ptr & ((S - 1) << b)));
-    cycles += next->read(ptr);
-    line->valid = true;
-    line->dirty = true;
-    line->timestamp = time;
-    line->tag = tag;
-    return cycles;
+    if (is_write && !write_allocate) {
+        uint64_t done = next->write_at(ptr, now);
+        if (prefetcher)
+            prefetch_miss(ptr, now);
+        return done;
+    }
+    auto entry = min_element(mshr.begin(), mshr.end());
+    if (*entry > now) {
+        mshr_stall_cycles += *entry - now;
+        now = *entry;
+    }
+    way = find_tag(tags + first, stride, INVALID_TAG);
+    if (way < 0)
+        way = (this->*evict)(set, first);
+    size_t line = first + way;
+    if (write_back && tags[line] != INVALID_TAG && dirty[line]) {
+        uint64_t start = now;
+        next->write_at((tags[line] << (b + s)) | (set << b), start);
+    }
+    uint64_t start = now + hit_cycles;
+    uint64_t done = next->read_at(ptr, start);
+    *entry = done;
+    tags[line] = tag;
+    dirty[line] = is_write;
+    (this->*insert)(set, first, way);
+    ready[line] = done;
+    if (prefetcher) {
+        prefetched[line] = false;
+        prefetch_miss(ptr, now);
+    }
+    return done;
+}
+
+uint64_t Cache::read_at(uintptr_t ptr, uint64_t& now)
+{
+    return timed_access<false>(ptr, now);
+}
+
+uint64_t Cache::write_at(uintptr_t ptr, uint64_t& now)
+{
+    return timed_access<true>(ptr, now);
+}
+
+void Cache::get_stats(uint64_t& hit, uint64_t& miss) const
+{
+    hit = hit_num;
+    miss = miss_num;
+}
+
+void Cache::set_stats(uint64_t hit, uint64_t miss)
+{
+    hit_num = hit;
+    miss_num = miss;
 }
 
 void Cache::print_info()
 {
     printf("%20s: hit=%-10lu miss=%-10lu miss_rate=%.3f%%\n", name.c_str(),
         hit_num, miss_num, (double)miss_num / (hit_num + miss_num) * 100);
+    if (prefetcher)
+        printf("%20s  %s prefetcher: issued=%-10lu useful=%-10lu late=%-10lu polluting=%lu\n", "",
+            prefetcher->get_name(), prefetch_issued, prefetch_useful, prefetch_late, prefetch_polluting);
+    if (non_blocking)
+        printf("%20s  MSHRs: count=%-10lu merged=%-10lu stall_cycles=%lu\n", "",
+            mshr.size(), mshr_merged, mshr_stall_cycles);
 }
 
+// the lines are saved by the guest address they hold
+void Cache::save(FILE *file) const
+{
+    int32_t geometry[3] = {S, E, b};
+    checkpoint_write(file, geometry, sizeof(geometry));
+    checkpoint_write(file, &time, sizeof(time));
+    checkpoint_write(file, &hit_num, sizeof(hit_num));
+    checkpoint_write(file, &miss_num, sizeof(miss_num));
 
-Memory::Memory(int cycles)
-    : cycles(cycles)
-{}
+    vector<SavedLine> saved_lines;
+    for (int i = 0; i < S; i++)
+        for (int j = 0; j < E; j++) {
+            size_t line = (size_t)i * stride + j;
+            uintptr_t addr = (tags[line] << (b + s)) | ((uintptr_t)i << b);
+            if (tags[line] != INVALID_TAG)
+                saved_lines.push_back({addr, timestamps ? timestamps[line] : 0, dirty[line]});
+        }
+    uint64_t line_num = saved_lines.size();
+    checkpoint_write(file, &line_num, sizeof(line_num));
+    checkpoint_write(file, saved_lines.data(), sizeof(SavedLine) * line_num);
+}
 
-int Memory::read(uintptr_t ptr)
+bool Cache::restore(FILE *file)
 {
-    return cycles;
+    int32_t geometry[3];
+    checkpoint_read(file, geometry, sizeof(geometry));
+    if (geometry[0] != S || geometry[1] != E || geometry[2] != b) {
+        fseek(file, -(long)sizeof(geometry), SEEK_CUR);
+        skip(file);
+        return false;
+    }
+    checkpoint_read(file, &time, sizeof(time));
+    checkpoint_read(file, &hit_num, sizeof(hit_num));
+    checkpoint_read(file, &miss_num, sizeof(miss_num));
+    uint64_t line_num;
+    checkpoint_read(file, &line_num, sizeof(line_num));
+    vector<SavedLine> saved_lines(line_num);
+    checkpoint_read(file, saved_lines.data(), sizeof(SavedLine) * line_num);
+
+    // the replacement state of the policies other than lru is not saved,
+    // the lines are inserted as if they were filled in the saved order
+    uint64_t saved_time = time, saved_hit_num = hit_num, saved_miss_num = miss_num;
+    invalidate();
+    time = saved_time;
+    hit_num = saved_hit_num;
+    miss_num = saved_miss_num;
+    for (auto &saved: saved_lines) {
+        uintptr_t addr = saved.addr;
+        // a corrupted file may list more lines of a set than it can hold,
+        // then the least recently used ones, or with other policies the
+        // last ones, are left out
+        size_t set = (addr >> b) & (S - 1), first = set * stride;
+        int way = find_tag(tags + first, stride, INVALID_TAG);
+        if (way < 0 && timestamps) {
+            way = lru_victim(first, E);
+            if (saved.timestamp < timestamps[first + way])
+                continue;
+        } else if (way < 0) {
+            continue;
+        }
+        tags[first + way] = addr >> (b + s);
+        dirty[first + way] = saved.dirty;
+        (this->*insert)(set, first, way);
+        if (timestamps)
+            timestamps[first + way] = saved.timestamp;
+    }
+    return true;
 }
 
-int Memory::write(uintptr_t ptr)
+void Cache::skip(FILE *file)
 {
-    return cycles;
+    int32_t geometry[3];
+    uint64_t line_num;
+    checkpoint_read(file, geometry, sizeof(geometry));
+    fseek(file, sizeof(time) + sizeof(hit_num) + sizeof(miss_num), SEEK_CUR);
+    checkpoint_read(file, &line_num, sizeof(line_num));
+    fseek(file, sizeof(SavedLine) * line_num, SEEK_CUR);
 }
+
+
+Memory::Memory(int cycles)
+    : cycles(cycles)
+{}
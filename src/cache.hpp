@@ -1,9 +1,64 @@
 #ifndef CACHE_HPP
 #define CACHE_HPP
 
+#include <cstdio>
 #include <string>
+#include <vector>
 #include <yaml-cpp/yaml.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "types.hpp"
+#include "prefetcher.hpp"
+
+// tags of invalid lines and of the padding after the last way of a set,
+// which no tag of an address can equal
+#define INVALID_TAG     (~0ULL)
+#define PADDING_TAG     (~1ULL)
+
+// the ways of a set are padded to a multiple of this
+#define WAY_ALIGN       4
+
+/**
+ *  The first of the `stride` ways of `set` holding `tag`, or -1. Tags are
+ *  compared 4 at a time when built with AVX2, otherwise 2 at a time with
+ *  SSE2, which has no 64-bit compare, so the 32-bit halves are compared.
+ */
+static inline int find_tag(const uint64_t *set, int stride, uint64_t tag)
+{
+    for (int base = 0; base < stride; base += 64) {
+        int end = stride - base < 64 ? stride : base + 64;
+        uint64_t mask = 0;
+#if defined(__AVX2__)
+        __m256i key = _mm256_set1_epi64x(tag);
+        for (int i = base; i < end; i += 4) {
+            __m256i eq = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i*)(set + i)), key);
+            mask |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << (i - base);
+        }
+#elif defined(__SSE2__)
+        __m128i key = _mm_set1_epi64x(tag);
+        for (int i = base; i < end; i += 2) {
+            __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(set + i)), key);
+            eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+            mask |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << (i - base);
+        }
+#else
+        for (int i = base; i < end; i++)
+            mask |= (uint64_t)(set[i] == tag) << (i - base);
+#endif
+        if (mask)
+            return base + __builtin_ctzll(mask);
+    }
+    return -1;
+}
+
+// what the memory system is doing, for the prefetchers of the caches
+struct AccessContext
+{
+    reg_t pc;       // of the instruction accessing memory
+    uint64_t cycle;
+    bool warming;   // functional warming, whose cycle stands still
+};
 
 class Storage
 {
@@ -11,40 +66,235 @@ public:
     // return the number of cycles required
     virtual int read(uintptr_t ptr) = 0;
     virtual int write(uintptr_t ptr) = 0;
+    // non-blocking mode: start the access at cycle `now`, which is moved to
+    // when the access is taken, and return the cycle its data is there
+    virtual uint64_t read_at(uintptr_t ptr, uint64_t& now) = 0;
+    virtual uint64_t write_at(uintptr_t ptr, uint64_t& now) = 0;
     virtual ~Storage() = default;
 };
 
+// a geometry and write policy compiled into the accesses of a Cache,
+// see FixedCache
+template <int Sets, int Ways, int LineBits, bool WriteBack = true, bool WriteAllocate = true>
+struct CacheShape
+{
+    static constexpr bool fixed = true;
+    static constexpr int sets = Sets, ways = Ways, line_bits = LineBits;
+    static constexpr int set_bits = __builtin_ctz(Sets);
+    static constexpr int stride = (Ways + WAY_ALIGN - 1) / WAY_ALIGN * WAY_ALIGN;
+    static constexpr bool write_back = WriteBack, write_allocate = WriteAllocate;
+};
+
+// the geometry and write policy given in the configuration
+struct DynamicShape
+{
+    static constexpr bool fixed = false;
+    static constexpr int sets = 0, ways = 0, line_bits = 0, set_bits = 0, stride = 0;
+    static constexpr bool write_back = false, write_allocate = false;
+};
+
+// re-reference prediction values of the RRIP policies, 2 bits
+#define RRPV_MAX        3
+// BRRIP inserts one line in this many with the long prediction of SRRIP
+#define BRRIP_PERIOD    32
+// DRRIP: sets `i` with i % DUEL_PERIOD of 0 always use SRRIP and of 1
+// BRRIP, the rest follow the one with fewer misses as counted by PSEL
+#define DUEL_PERIOD     32
+#define PSEL_MAX        1023
+
 class Cache : public Storage
 {
 private:
     std::string name;
     int S, s, E, b;
+    int stride;  // E rounded up to WAY_ALIGN
     bool write_back;
     bool write_allocate;
     int hit_cycles;
     Storage *next;
-    uint32_t time;
+    uint64_t time;
     uint64_t hit_num, miss_num;
 
-    struct CacheLine
+    // the lines as arrays of their fields, `stride` entries per set, in a
+    // single allocation, so the tags of a set are compared at once. The
+    // arrays of the replacement state are only allocated for the policies
+    // using them.
+    uint64_t *tags;         // INVALID_TAG if not valid
+    uint8_t *dirty;
+    uint64_t *timestamps;   // lru: the time of the last access
+    uint8_t *state;         // plru: tree nodes 1..E-1, rrip: RRPV of the lines
+    uint32_t *set_state;    // fifo: the next way of each set to replace
+    size_t storage_size;
+    void *storage;
+
+    // the replacement policy, resolved when the cache is built: `touch`
+    // marks a hit, `evict` picks a way of a full set and `insert` marks the
+    // way filled on a miss
+    std::string replacement;
+    void (Cache::*touch)(size_t set, size_t first, int way);
+    int (Cache::*evict)(size_t set, size_t first);
+    void (Cache::*insert)(size_t set, size_t first, int way);
+    uint64_t random_state;  // random: xorshift
+    uint32_t brrip_count;   // brrip, drrip: the insertions
+    uint32_t psel;          // drrip: the policy selector
+
+    // with a prefetcher or in non-blocking mode, the cycle the data of
+    // each line arrives, and with a prefetcher the lines it brought in and
+    // not used yet. A demand miss on a line which a prefetch
+    // evicted is found in `pollution`, which holds the lines evicted by
+    // prefetches, indexed by their low bits.
+    Prefetcher *prefetcher;
+    const AccessContext *context;
+    uint8_t *prefetched;
+    uint64_t *ready;
+    std::vector<uint64_t> pollution;
+    uint64_t prefetch_issued, prefetch_useful, prefetch_late, prefetch_polluting;
+
+    int prefetch_hit(uintptr_t ptr, size_t line, uint64_t now);
+    void prefetch_miss(uintptr_t ptr, uint64_t now);
+    void prefetch(uintptr_t ptr, PrefetchTrigger trigger, uint64_t now);
+
+    // non-blocking mode: the cycle each MSHR is busy until
+    bool non_blocking;
+    std::vector<uint64_t> mshr;
+    uint64_t mshr_merged, mshr_stall_cycles;
+
+    template <bool is_write>
+    uint64_t timed_access(uintptr_t ptr, uint64_t& now);
+
+    void nothing(size_t set, size_t first, int way) {}
+    inline void lru_touch(size_t set, size_t first, int way)
     {
-        bool valid, dirty;
-        uint32_t timestamp;
-        uint64_t tag;
-    } **cache_set;
+        timestamps[first + way] = time;
+    }
+    inline int lru_victim(size_t first, int ways) const
+    {
+        int way = 0;
+        for (int i = 1; i < ways; i++)
+            if (timestamps[first + i] < timestamps[first + way])
+                way = i;
+        return way;
+    }
+    int lru_evict(size_t set, size_t first);
+    void plru_touch(size_t set, size_t first, int way);
+    int plru_evict(size_t set, size_t first);
+    void rrip_touch(size_t set, size_t first, int way);
+    int rrip_evict(size_t set, size_t first);
+    void srrip_insert(size_t set, size_t first, int way);
+    void brrip_insert(size_t set, size_t first, int way);
+    void drrip_insert(size_t set, size_t first, int way);
+    int fifo_evict(size_t set, size_t first);
+    int random_evict(size_t set, size_t first);
 
-    CacheLine* get_cache_line(uintptr_t ptr);
+    // a valid line in a checkpoint, the timestamp is only kept by lru
+    struct SavedLine
+    {
+        uint64_t addr;
+        uint64_t timestamp;
+        uint64_t dirty;
+    };
 
 public:
-    Cache(const YAML::Node& config);
+    Cache(const YAML::Node& config, bool non_blocking = false);
     ~Cache();
     std::string get_name() const;
     unsigned get_line_size() const;
     void set_next(Storage *st);
+    Storage* get_next() const;
+    void set_context(const AccessContext *ctx);
     void invalidate();
+    void reset_timing();  // forget the accesses in flight
     int read(uintptr_t ptr);
     int write(uintptr_t ptr);
+    uint64_t read_at(uintptr_t ptr, uint64_t& now);
+    uint64_t write_at(uintptr_t ptr, uint64_t& now);
+    void get_stats(uint64_t& hit, uint64_t& miss) const;
+    void set_stats(uint64_t hit, uint64_t miss);
     void print_info();
+
+    // checkpoint of the lines and the counters, restore returns false and
+    // leaves the cache cold if the geometry in the file differs
+    void save(FILE *file) const;
+    bool restore(FILE *file);
+    static void skip(FILE *file);
+
+    // fixed shapes are compiled with lru, blocking and without prefetcher
+    template <class Shape>
+    bool has_shape() const
+    {
+        return S == Shape::sets && E == Shape::ways && b == Shape::line_bits &&
+            write_back == Shape::write_back && write_allocate == Shape::write_allocate &&
+            replacement == "lru" && !prefetcher && !non_blocking;
+    }
+
+    /**
+     *  Read or write the line of `ptr`, going to `lower` on a miss. With a
+     *  fixed Shape the geometry is constant, the policy is lru and `lower`
+     *  is the FixedCache of the next level, so the whole path is inlined;
+     *  read and write use this with the configured geometry and policy and
+     *  the next Storage.
+     */
+    template <bool is_write, class Shape, class Lower>
+    inline int access(uintptr_t ptr, Lower& lower)
+    {
+        const int sets = Shape::fixed ? Shape::sets : S;
+        const int ways = Shape::fixed ? Shape::ways : E;
+        const int line_bits = Shape::fixed ? Shape::line_bits : b;
+        const int tag_shift = Shape::fixed ? Shape::line_bits + Shape::set_bits : b + s;
+        const int set_stride = Shape::fixed ? Shape::stride : stride;
+        const bool wb = Shape::fixed ? Shape::write_back : write_back;
+        const bool wa = Shape::fixed ? Shape::write_allocate : write_allocate;
+
+        time++;
+        size_t set = (ptr >> line_bits) & (sets - 1);
+        size_t first = set * set_stride;
+        uint64_t *set_tags = tags + first;
+        uint64_t tag = ptr >> tag_shift;
+        int way = find_tag(set_tags, set_stride, tag);
+        if (way >= 0) {
+            hit_num++;
+            if (Shape::fixed)
+                lru_touch(set, first, way);
+            else
+                (this->*touch)(set, first, way);
+            int cycles = hit_cycles;
+            if (!Shape::fixed && prefetcher)
+                cycles += prefetch_hit(ptr, first + way, context->cycle);
+            if (!is_write)
+                return cycles;
+            dirty[first + way] = true;
+            return wb ? cycles : cycles + lower.write(ptr);
+        }
+
+        miss_num++;
+        if (is_write && !wa) {
+            int cycles = lower.write(ptr);
+            if (!Shape::fixed && prefetcher)
+                prefetch_miss(ptr, context->cycle);
+            return cycles;
+        }
+        way = find_tag(set_tags, set_stride, INVALID_TAG);
+        if (way < 0)
+            way = Shape::fixed ? lru_victim(first, ways) : (this->*evict)(set, first);
+        size_t line = first + way;
+        int cycles = hit_cycles;
+        if (wb && set_tags[way] != INVALID_TAG && dirty[line])
+            cycles += lower.write((set_tags[way] << tag_shift) | (ptr & ((sets - 1) << line_bits)));
+        cycles += lower.read(ptr);
+        set_tags[way] = tag;
+        dirty[line] = is_write;
+        if (Shape::fixed)
+            lru_touch(set, first, way);
+        else
+            (this->*insert)(set, first, way);
+        if (!Shape::fixed && ready)
+            ready[line] = 0;
+        if (!Shape::fixed && prefetcher) {
+            prefetched[line] = false;
+            prefetch_miss(ptr, context->cycle);
+        }
+        return cycles;
+    }
 };
 
 class Memory : public Storage
@@ -54,8 +304,57 @@ private:
 
 public:
     Memory(int cycles);
-    int read(uintptr_t ptr);
-    int write(uintptr_t ptr);
+    int read(uintptr_t ptr) { return cycles; }
+    int write(uintptr_t ptr) { return cycles; }
+    uint64_t read_at(uintptr_t ptr, uint64_t& now) { return now + cycles; }
+    uint64_t write_at(uintptr_t ptr, uint64_t& now) { return now + cycles; }
+};
+
+/**
+ *  A Cache whose Shape is known at compile time, with the levels below it
+ *  as `Next`, down to FixedMemory. The chain holds no state of its own: it
+ *  is bound to the Cache objects built from the configuration, and only
+ *  replaces their virtual calls and configured geometry.
+ */
+template <class Shape, class Next>
+struct FixedCache
+{
+    Cache *cache;
+    Next next;
+
+    // bind to `st` and the levels below it, false if their shapes differ
+    bool bind(Storage *st)
+    {
+        cache = dynamic_cast<Cache*>(st);
+        return cache && cache->has_shape<Shape>() && next.bind(cache->get_next());
+    }
+
+    inline int read(uintptr_t ptr) { return cache->access<false, Shape>(ptr, next); }
+    inline int write(uintptr_t ptr) { return cache->access<true, Shape>(ptr, next); }
+};
+
+struct FixedMemory
+{
+    Memory *memory;
+
+    bool bind(Storage *st)
+    {
+        memory = dynamic_cast<Memory*>(st);
+        return memory;
+    }
+
+    inline int read(uintptr_t ptr) { return memory->Memory::read(ptr); }
+    inline int write(uintptr_t ptr) { return memory->Memory::write(ptr); }
+};
+
+// the caches of default_config.yml, the L1 caches sharing L2
+using DefaultL3 = FixedCache<CacheShape<8192, 16, 6>, FixedMemory>;
+using DefaultL2 = FixedCache<CacheShape<1024, 8, 6>, DefaultL3>;
+
+struct DefaultHierarchy
+{
+    FixedCache<CacheShape<64, 12, 6>, DefaultL2> inst;
+    FixedCache<CacheShape<64, 8, 6>, DefaultL2> data;
 };
 
 #endif
@@ -0,0 +1,46 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdio>
+#include <string>
+#include "types.hpp"
+
+#define CHECKPOINT_MAGIC    "RVCKPT\0\0"
+#define CHECKPOINT_VERSION  5
+
+// helpers to read and write the fields of a checkpoint file
+
+inline void checkpoint_write(FILE *file, const void *ptr, size_t size)
+{
+    if (fwrite(ptr, 1, size, file) != size)
+        throw_error("cannot write checkpoint");
+}
+
+inline void checkpoint_read(FILE *file, void *ptr, size_t size)
+{
+    if (fread(ptr, 1, size, file) != size)
+        throw_error("cannot read checkpoint, the file is truncated");
+}
+
+// write `field` when `saving`, otherwise read it back
+template<class T>
+inline void checkpoint_transfer(FILE *file, T& field, bool saving)
+{
+    if (saving)
+        checkpoint_write(file, &field, sizeof(T));
+    else
+        checkpoint_read(file, &field, sizeof(T));
+}
+
+inline void checkpoint_transfer(FILE *file, std::string& str, bool saving)
+{
+    uint64_t length = str.size();
+    checkpoint_transfer(file, length, saving);
+    str.resize(length);
+    if (saving)
+        checkpoint_write(file, str.data(), length);
+    else
+        checkpoint_read(file, &str[0], length);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "decode_cache.hpp"
+#include "decode_helpers.hpp"
+using namespace std;
+
+DecodeCache::DecodeCache(MemorySystem& mem_sys)
+    : mem_sys(mem_sys), last_va(-1), last_page(nullptr)
+{}
+
+DecodeCache::~DecodeCache()
+{
+    for (const auto &pr: pages)
+        delete pr.second;
+}
+
+DecodeCache::DecodedPage* DecodeCache::get_page(uintptr_t va)
+{
+    auto it = pages.find(PGADDR(va));
+    if (it == pages.end())
+        return nullptr;
+    last_va = PGADDR(va);
+    last_page = it->second;
+    return last_page;
+}
+
+const EXReg& DecodeCache::fill(reg_t pc, inst_t inst)
+{
+    auto page = get_page(pc);
+    if (!page) {
+        page = new DecodedPage;
+        memset(page->valid, 0, sizeof(page->valid));
+        pages[PGADDR(pc)] = page;
+        last_va = PGADDR(pc);
+        last_page = page;
+    }
+
+    unsigned index = PGOFF(pc) >> 1;
+    EXReg& e = page->inst[index];
+    e = {};
+    parse_inst(inst, e);
+    page->valid[index] = true;
+
+    // an instruction may lie across the page boundary
+    mem_sys.mark_code_page(pc);
+    if (PGOFF(pc) > PGSIZE - (e.compressed_inst ? 2 : 4))
+        mem_sys.mark_code_page(pc + 2);
+    return e;
+}
+
+void DecodeCache::invalidate_code_page(uintptr_t va)
+{
+    auto it = pages.find(PGADDR(va));
+    if (it != pages.end())
+        memset(it->second->valid, 0, sizeof(it->second->valid));
+
+    // the last halfword of the previous page may hold the
+    // beginning of an instruction spanning into this page
+    it = pages.find(PGADDR(va) - PGSIZE);
+    if (it != pages.end())
+        it->second->valid[PGSIZE / 2 - 1] = false;
+}
+
+void DecodeCache::invalidate_all_code()
+{
+    for (const auto &pr: pages)
+        delete pr.second;
+    pages.clear();
+    last_va = -1;
+    last_page = nullptr;
+}
@@ -0,0 +1,50 @@
+#ifndef DECODE_CACHE_HPP
+#define DECODE_CACHE_HPP
+
+#include <unordered_map>
+#include "register_def.hpp"
+#include "memory_system.hpp"
+
+/**
+ *  Decoded instructions indexed by pc. An entry is filled the first time
+ *  the instruction is fetched, so `parse_inst` runs once per static
+ *  instruction. Pages holding entries are marked as code in the memory
+ *  system, and a guest store to them drops the entries of that page.
+ */
+class DecodeCache : public CodeObserver
+{
+private:
+    struct DecodedPage
+    {
+        bool valid[PGSIZE / 2];
+        EXReg inst[PGSIZE / 2];
+    };
+
+    MemorySystem& mem_sys;
+    std::unordered_map<uintptr_t, DecodedPage*> pages;
+    uintptr_t last_va;
+    DecodedPage *last_page;
+
+    DecodedPage* get_page(uintptr_t va);
+    const EXReg& fill(reg_t pc, inst_t inst);
+
+public:
+    DecodeCache(MemorySystem& mem_sys);
+    ~DecodeCache();
+
+    // return the decoded template of `inst` at `pc`, without
+    // pc, val1 and val2 filled
+    inline const EXReg& lookup(reg_t pc, inst_t inst)
+    {
+        auto page = PGADDR(pc) == last_va ? last_page : get_page(pc);
+        unsigned index = PGOFF(pc) >> 1;
+        if (page && page->valid[index])
+            return page->inst[index];
+        return fill(pc, inst);
+    }
+
+    void invalidate_code_page(uintptr_t va);
+    void invalidate_all_code();
+};
+
+#endif
@@ -1,95 +1,102 @@
-#include <map>
-#include <tuple>
+#include <array>
+#include <string>
 #include "decode_helpers.hpp"
 using namespace std;
 
-static const map<uint8_t, map<uint8_t, ALU_OP>> R_alu_op_map = {
-    {0x0, {
-        {0x00, ALU_ADD},
-        {0x01, ALU_MUL},
-        {0x20, ALU_SUB},
-    }},
-    {0x1, {
-        {0x00, ALU_SLL},
-        {0x01, ALU_MULH},
-    }},
-    {0x2, {
-        {0x00, ALU_SLT},
-        {0x01, ALU_MULHSU},
-    }},
-    {0X3, {
-        {0x00, ALU_SLTU},
-        {0X01, ALU_MULHU},
-    }},
-    {0x4, {
-        {0x00, ALU_XOR},
-        {0x01, ALU_DIV},
-    }},
-    {0x5, {
-        {0x00, ALU_SRL},
-        {0x01, ALU_DIVU},
-        {0x20, ALU_SRA},
-    }},
-    {0x6, {
-        {0x00, ALU_OR},
-        {0x01, ALU_REM},
-    }},
-    {0x7, {
-        {0x00, ALU_AND},
-        {0X01, ALU_REMU},
-    }},
+// an entry of the ALU operation tables below
+struct AluOpEntry
+{
+    uint8_t funct3, funct7;
+    ALU_OP alu_op;
+};
+
+// ALU operations indexed by funct3 << 7 | funct7, N_ALU_OP if reserved
+using AluOpTable = array<ALU_OP, 8 << 7>;
+
+template <size_t N>
+static constexpr AluOpTable make_alu_op_table(const AluOpEntry (&entries)[N])
+{
+    AluOpTable table = {};
+    for (auto &alu_op: table)
+        alu_op = N_ALU_OP;
+    for (const auto &entry: entries)
+        table[entry.funct3 << 7 | entry.funct7] = entry.alu_op;
+    return table;
+}
+
+static constexpr AluOpEntry R_alu_ops[] = {
+    {0x0, 0x00, ALU_ADD},
+    {0x0, 0x01, ALU_MUL},
+    {0x0, 0x20, ALU_SUB},
+    {0x1, 0x00, ALU_SLL},
+    {0x1, 0x01, ALU_MULH},
+    {0x2, 0x00, ALU_SLT},
+    {0x2, 0x01, ALU_MULHSU},
+    {0x3, 0x00, ALU_SLTU},
+    {0x3, 0x01, ALU_MULHU},
+    {0x4, 0x00, ALU_XOR},
+    {0x4, 0x01, ALU_DIV},
+    {0x5, 0x00, ALU_SRL},
+    {0x5, 0x01, ALU_DIVU},
+    {0x5, 0x20, ALU_SRA},
+    {0x6, 0x00, ALU_OR},
+    {0x6, 0x01, ALU_REM},
+    {0x7, 0x00, ALU_AND},
+    {0x7, 0x01, ALU_REMU},
 };
 
-static const map<uint8_t, map<uint8_t, ALU_OP>> I_alu_op_map = {
-    {0x0, {
-        {0x00, ALU_ADD},
-    }},
-    {0x1, {
-        {0x00, ALU_SLL},
-    }},
-    {0x2, {
-        {0x00, ALU_SLT},
-    }},
-    {0x3, {
-        {0x00, ALU_SLTU},
-    }},
-    {0x4, {
-        {0x00, ALU_XOR},
-    }},
-    {0x5, {
-        {0x00, ALU_SRL},
-        {0x10, ALU_SRA},
-    }},
-    {0x6, {
-        {0x00, ALU_OR},
-    }},
-    {0x7, {
-        {0x00, ALU_AND},
-    }},
+// funct7 of the shifts is the upper 6 bits, as shamt has 6 bits
+static constexpr AluOpEntry I_alu_ops[] = {
+    {0x0, 0x00, ALU_ADD},
+    {0x1, 0x00, ALU_SLL},
+    {0x2, 0x00, ALU_SLT},
+    {0x3, 0x00, ALU_SLTU},
+    {0x4, 0x00, ALU_XOR},
+    {0x5, 0x00, ALU_SRL},
+    {0x5, 0x10, ALU_SRA},
+    {0x6, 0x00, ALU_OR},
+    {0x7, 0x00, ALU_AND},
 };
 
-static const map<uint8_t, tuple<uint8_t, ALU_OP>> C_R_op_map = {
-    {0x0 << 2 | 0, {0x33, ALU_SUB}},
-    {0x1 << 2 | 0, {0x33, ALU_XOR}},
-    {0x2 << 2 | 0, {0x33, ALU_OR}},
-    {0x3 << 2 | 0, {0x33, ALU_AND}},
-    {0x0 << 2 | 1, {0x3b, ALU_SUB}},
-    {0x1 << 2 | 1, {0x3b, ALU_ADD}},
+static constexpr AluOpTable R_alu_op_table = make_alu_op_table(R_alu_ops);
+static constexpr AluOpTable I_alu_op_table = make_alu_op_table(I_alu_ops);
+
+// c.sub, c.xor, ... indexed by bits 6:5 << 1 | bit 12, opcode 0 if reserved
+struct CompressedROp
+{
+    uint8_t opcode;
+    ALU_OP alu_op;
+};
+
+static constexpr CompressedROp C_R_ops[8] = {
+    {0x33, ALU_SUB},  // c.sub
+    {0x3b, ALU_SUB},  // c.subw
+    {0x33, ALU_XOR},  // c.xor
+    {0x3b, ALU_ADD},  // c.addw
+    {0x33, ALU_OR},   // c.or
+    {0, N_ALU_OP},
+    {0x33, ALU_AND},  // c.and
+    {0, N_ALU_OP},
 };
 
 /**
  *  extract `count` bits from `start` in `inst` and left shift `shamt` bits
  */
-inline uint32_t getbits(inst_t inst, int start, int count, int shamt = 0)
+constexpr uint32_t getbits(inst_t inst, int start, int count, int shamt = 0)
 {
     return ((inst >> start) & ((1 << count) - 1)) << shamt;
 }
 
-inline void parse_16b_inst(inst_t inst, EXReg& e)
+/**
+ *  Fill `e` with the 32-bit instruction `inst` expands to, return false if
+ *  the encoding is reserved. It runs at compile time to build the table of
+ *  all compressed instructions below.
+ */
+static constexpr bool expand_16b_inst(inst_t inst, EXReg& e)
 {
     uint8_t opcode = (uint8_t)getbits(inst, 0, 2);
     uint8_t funct3 = (uint8_t)getbits(inst, 13, 3);
-    uint8_t funct2;
+    uint8_t funct2 = 0;
     switch (opcode) {
     case 0x0:
         switch (funct3) {
@@ -131,7 +138,7 @@ inline void parse_16b_inst(inst_t inst, EXReg& e)
             e.imm = getbits(inst, 5, 2, 6) | getbits(inst, 10, 3, 3);
             break;
         default:
-            throw_error("unknown compressed inst: %x", inst);
+            return false;
         }
         break;
 
@@ -198,19 +205,18 @@ inline void parse_16b_inst(inst_t inst, EXReg& e)
                 e.imm = sign_extend(e.imm, 6);
                 e.alu_op = ALU_AND;
                 break;
-            case 0x3:
+            case 0x3: {
                 e.rd = e.rs1 = 8 | getbits(inst, 7, 3);
                 e.rs2 = 8 | getbits(inst, 2, 3);
-                try {
-                    uint8_t funct = getbits(inst, 5, 2);
-                    uint8_t funct1 = getbits(inst, 12, 1);
-                    //! Does not maintain e.funct3
-                    tie(e.opcode, e.alu_op) = C_R_op_map.at(funct << 2 | funct1);
-                } catch (const out_of_range&) {
-                    throw_error("reserved compressed inst");
-                }
+                //! Does not maintain e.funct3
+                const CompressedROp& op = C_R_ops[getbits(inst, 5, 2, 1) | getbits(inst, 12, 1)];
+                if (!op.opcode)
+                    return false;
+                e.opcode = op.opcode;
+                e.alu_op = op.alu_op;
                 break;
             }
+            }
             break;
         case 0x5:  // j => jal x0, offset[11:1]
             e.opcode = OP_JAL;
@@ -266,9 +272,10 @@ inline void parse_16b_inst(inst_t inst, EXReg& e)
                     // jr => jalr x0, rs1, 0
                     e.opcode = OP_JALR;
                 } else {
-                    // mv => add r0, x0, rs2
+                    // mv => add rd, x0, rs2
                     e.opcode = OP_RR;
-                    swap(e.rd, e.rs1);
+                    e.rd = e.rs1;
+                    e.rs1 = 0;
                 }
                 break;
             case 1:
@@ -302,9 +309,56 @@ inline void parse_16b_inst(inst_t inst, EXReg& e)
             e.rs2 = getbits(inst, 2, 5);
             break;
         default:
-            throw_error("unknown compressed inst: op 0x%02x funct3 0x%02x", opcode, funct3);
+            return false;
         }
     }
+    return true;
+}
+
+// a compressed instruction expanded by expand_16b_inst
+struct CompressedInst
+{
+    bool valid;
+    uint8_t opcode, funct3;
+    reg_num_t rs1, rs2, rd;
+    uint8_t alu_op;
+    int32_t imm;
+};
+
+/**
+ *  Every compressed instruction expanded at compile time, indexed by the
+ *  lowest 2 bits and then the upper 14 bits of the encoding. Looking up an
+ *  entry replaces the nested switches of expand_16b_inst.
+ */
+static constexpr auto compressed_insts = [] {
+    array<CompressedInst, 3 << 14> table = {};
+    for (inst_t index = 0; index < table.size(); index++) {
+        EXReg e = {};
+        CompressedInst& c = table[index];
+        c.valid = expand_16b_inst((index & 0x3FFF) << 2 | index >> 14, e);
+        c.opcode = e.opcode;
+        c.funct3 = e.funct3;
+        c.rs1 = e.rs1;
+        c.rs2 = e.rs2;
+        c.rd = e.rd;
+        c.alu_op = e.alu_op;
+        c.imm = (int32_t)e.imm;
+    }
+    return table;
+}();
+
+inline void parse_16b_inst(inst_t inst, EXReg& e)
+{
+    const CompressedInst& c = compressed_insts[(inst & 3) << 14 | getbits(inst, 2, 14)];
+    if (!c.valid)
+        throw_error("unknown compressed inst: %04x", inst & 0xFFFF);
+    e.opcode = c.opcode;
+    e.funct3 = c.funct3;
+    e.rs1 = c.rs1;
+    e.rs2 = c.rs2;
+    e.rd = c.rd;
+    e.alu_op = (ALU_OP)c.alu_op;
+    e.imm = (int64_t)c.imm;
 }
 
 /**
@@ -385,19 +439,15 @@ inline void parse_32b_inst(inst_t inst, EXReg& e)
     switch (e.opcode) {
     case OP_RR:  // R-TYPE, Integer Register-Register Operations
         parse_R_Type(inst, e, funct7);
-        try {
-            e.alu_op = R_alu_op_map.at(e.funct3).at(funct7);
-        } catch (const out_of_range& err) {
+        e.alu_op = R_alu_op_table[e.funct3 << 7 | funct7];
+        if (e.alu_op == N_ALU_OP)
             throw_error(msg_template, inst, e.opcode, e.funct3, funct7);
-        }
         break;
     case OP_RRW:  // R-TYPE, Integer Register-Register Operations
         parse_R_Type(inst, e, funct7);
-        try {
-            e.alu_op = R_alu_op_map.at(e.funct3).at(funct7);
-        } catch (const out_of_range& err) {
+        e.alu_op = R_alu_op_table[e.funct3 << 7 | funct7];
+        if (e.alu_op == N_ALU_OP)
             throw_error(msg_template, inst, e.opcode, e.funct3, funct7);
-        }
         break;
     case OP_LOAD:  // I-TYPE, Load Instructions
         parse_I_Type(inst, e, funct7);
@@ -412,11 +462,9 @@ inline void parse_32b_inst(inst_t inst, EXReg& e)
             funct7 = 0;
             e.imm = sign_extend(e.imm, 12);
         }
-        try {
-            e.alu_op = I_alu_op_map.at(e.funct3).at(funct7);
-        } catch (const out_of_range& err) {
+        e.alu_op = I_alu_op_table[e.funct3 << 7 | funct7];
+        if (e.alu_op == N_ALU_OP)
             throw_error(msg_template, inst, e.opcode, e.funct3, funct7);
-        }
         break;
     case OP_RIW:  // I-TYPE, Integer Register-Immediate Instructions
         parse_I_Type(inst, e, funct7);
@@ -427,11 +475,9 @@ inline void parse_32b_inst(inst_t inst, EXReg& e)
             funct7 = 0;
             e.imm = sign_extend(e.imm, 12);
         }
-        try {
-            e.alu_op = I_alu_op_map.at(e.funct3).at(funct7);
-        } catch (const out_of_range& err) {
+        e.alu_op = I_alu_op_table[e.funct3 << 7 | funct7];
+        if (e.alu_op == N_ALU_OP)
             throw_error(msg_template, inst, e.opcode, e.funct3, funct7);
-        }
         break;
     case OP_JALR:  // I-TYPE, jalr
         parse_I_Type(inst, e, funct7);
@@ -475,3 +521,103 @@ void parse_inst(inst_t inst, EXReg& e)
         parse_32b_inst(inst, e);
     }
 }
+
+static const char *alu_op_name[N_ALU_OP] = {
+    "add", "sub", "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem",
+    "remu", "sll", "sra", "srl", "xor", "or", "and", "slt", "sltu"
+};
+
+static const char *load_name[8] = {"lb", "lh", "lw", "ld", "lbu", "lhu", "lwu", nullptr};
+static const char *store_name[4] = {"sb", "sh", "sw", "sd"};
+static const char *branch_name[8] = {"beq", "bne", nullptr, nullptr, "blt", "bge", "bltu", "bgeu"};
+
+/**
+ *  Compressed instructions are shown as the instructions they expand to,
+ *  and the common pseudo-instructions under their own names, as objdump
+ *  does.
+ */
+string disassemble_inst(inst_t inst, reg_t pc)
+{
+    EXReg e = {};
+    try {
+        parse_inst(inst, e);
+    } catch (const runtime_error&) {
+        return "unknown";
+    }
+    const char *rd = reg_abi_name[e.rd], *rs1 = reg_abi_name[e.rs1], *rs2 = reg_abi_name[e.rs2];
+    long imm = (long)e.imm;
+    char buf[64];
+    switch (e.opcode) {
+    case OP_RR:
+    case OP_RRW: {
+        string name = string(alu_op_name[e.alu_op]) + (e.opcode == OP_RRW ? "w" : "");
+        if (e.opcode == OP_RR && e.alu_op == ALU_ADD && e.rs1 == 0)
+            snprintf(buf, sizeof(buf), "mv\t%s,%s", rd, rs2);
+        else
+            snprintf(buf, sizeof(buf), "%s\t%s,%s,%s", name.c_str(), rd, rs1, rs2);
+        break;
+    }
+    case OP_RI:
+    case OP_RIW: {
+        string name = e.alu_op == ALU_SLTU ? "sltiu" : string(alu_op_name[e.alu_op]) + "i";
+        if (e.opcode == OP_RIW)
+            name += "w";
+        if (e.opcode == OP_RI && e.alu_op == ALU_ADD && e.rd == 0 && e.rs1 == 0 && imm == 0)
+            snprintf(buf, sizeof(buf), "nop");
+        else if (e.opcode == OP_RI && e.alu_op == ALU_ADD && e.rs1 == 0)
+            snprintf(buf, sizeof(buf), "li\t%s,%ld", rd, imm);
+        else if (e.alu_op == ALU_ADD && imm == 0)
+            snprintf(buf, sizeof(buf), "%s\t%s,%s", e.opcode == OP_RI ? "mv" : "sext.w", rd, rs1);
+        else
+            snprintf(buf, sizeof(buf), "%s\t%s,%s,%ld", name.c_str(), rd, rs1, imm);
+        break;
+    }
+    case OP_LOAD:
+        if (!load_name[e.funct3])
+            return "unknown";
+        snprintf(buf, sizeof(buf), "%s\t%s,%ld(%s)", load_name[e.funct3], rd, imm, rs1);
+        break;
+    case OP_STORE:
+        if (e.funct3 > 3)
+            return "unknown";
+        snprintf(buf, sizeof(buf), "%s\t%s,%ld(%s)", store_name[e.funct3], rs2, imm, rs1);
+        break;
+    case OP_BRANCH:
+        if (!branch_name[e.funct3])
+            return "unknown";
+        if (e.rs2 == 0 && e.funct3 <= 1)
+            snprintf(buf, sizeof(buf), "%sz\t%s,%lx", branch_name[e.funct3], rs1, pc + imm);
+        else
+            snprintf(buf, sizeof(buf), "%s\t%s,%s,%lx", branch_name[e.funct3], rs1, rs2, pc + imm);
+        break;
+    case OP_JAL:
+        if (e.rd == 0)
+            snprintf(buf, sizeof(buf), "j\t%lx", pc + imm);
+        else if (e.rd == REG_RA)
+            snprintf(buf, sizeof(buf), "jal\t%lx", pc + imm);
+        else
+            snprintf(buf, sizeof(buf), "jal\t%s,%lx", rd, pc + imm);
+        break;
+    case OP_JALR:
+        if (e.rd == 0 && e.rs1 == REG_RA && imm == 0)
+            snprintf(buf, sizeof(buf), "ret");
+        else if (e.rd == 0 && imm == 0)
+            snprintf(buf, sizeof(buf), "jr\t%s", rs1);
+        else if (e.rd == REG_RA && imm == 0)
+            snprintf(buf, sizeof(buf), "jalr\t%s", rs1);
+        else
+            snprintf(buf, sizeof(buf), "jalr\t%s,%ld(%s)", rd, imm, rs1);
+        break;
+    case OP_LUI:
+    case OP_AUIPC:
+        snprintf(buf, sizeof(buf), "%s\t%s,0x%lx", e.opcode == OP_LUI ? "lui" : "auipc",
+            rd, (e.imm >> 12) & 0xFFFFF);
+        break;
+    case OP_ECALL:
+        snprintf(buf, sizeof(buf), "ecall");
+        break;
+    default:  // only the compressed ebreak is accepted without an opcode
+        snprintf(buf, sizeof(buf), "ebreak");
+    }
+    return buf;
+}
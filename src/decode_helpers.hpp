@@ -3,7 +3,7 @@
 
 #include "register_def.hpp"
 
-inline reg_t sign_extend(reg_t reg, int bits)
+constexpr reg_t sign_extend(reg_t reg, int bits)
 {
     if (bits == 64 || ((reg >> (bits - 1)) & 1) == 0)
         return reg;
@@ -14,11 +14,14 @@ inline reg_t sign_extend(reg_t reg, int bits)
     // return reg;
 }
 
-inline reg_t zero_extend(reg_t reg, int bits)
+constexpr reg_t zero_extend(reg_t reg, int bits)
 {
     return reg & (-1ULL >> (64 - bits));
 }
 
 void parse_inst(inst_t inst, EXReg& e);
 
+// assembly of the instruction at `pc`, in the syntax of objdump
+std::string disassemble_inst(inst_t inst, reg_t pc);
+
 #endif
@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <algorithm>
+#include "dram.hpp"
+using namespace std;
+
+const char *Dram::field_names[FIELDS] = {"row", "rank", "bank", "channel", "column"};
+
+// the context of a DRAM outside a memory system
+static const AccessContext no_context = {0, 0, false};
+
+static inline bool is_power_of_2(uint64_t x)
+{
+    return x && !(x & (x - 1));
+}
+
+static inline int log2(uint64_t x)
+{
+    int ret = 0;
+    for (; x > 1; x >>= 1)
+        ret++;
+    return ret;
+}
+
+Dram::Dram(const YAML::Node& config)
+    : context(&no_context)
+{
+    uint64_t row_bytes, burst_bytes;
+    string page_policy, scheduler;
+    vector<string> mapping;
+    try {
+        channels = config["channels"].as<int>(1);
+        ranks = config["ranks"].as<int>(1);
+        banks = config["banks"].as<int>(8);
+        row_bytes = config["row_bytes"].as<uint64_t>(8192);
+        burst_bytes = config["burst_bytes"].as<uint64_t>(64);
+        tRCD = config["tRCD"].as<int>(40);
+        tCAS = config["tCAS"].as<int>(40);
+        tRP = config["tRP"].as<int>(40);
+        tRAS = config["tRAS"].as<int>(100);
+        tBURST = config["tBURST"].as<int>(10);
+        controller_cycles = config["controller_cycles"].as<int>(20);
+        page_policy = config["page_policy"].as<string>("open");
+        scheduler = config["scheduler"].as<string>("fr_fcfs");
+        mapping = config["address_mapping"].as<vector<string>>(
+            vector<string>(field_names, field_names + FIELDS));
+    } catch (const YAML::BadConversion&) {
+        throw ConfigError("dram config error");
+    }
+    if (!is_power_of_2(channels) || !is_power_of_2(ranks) || !is_power_of_2(banks) ||
+        !is_power_of_2(row_bytes) || !is_power_of_2(burst_bytes) || burst_bytes > row_bytes)
+        throw ConfigError("channels, ranks, banks, row_bytes and burst_bytes of dram must be "
+            "powers of 2, with burst_bytes <= row_bytes");
+    if (page_policy != "open" && page_policy != "closed")
+        throw ConfigError("page_policy of dram must be open or closed");
+    if (scheduler != "fr_fcfs" && scheduler != "fcfs")
+        throw ConfigError("scheduler of dram must be fr_fcfs or fcfs");
+    open_page = page_policy == "open";
+    fr_fcfs = scheduler == "fr_fcfs";
+
+    // the fields from the most significant, the row takes the bits left
+    int field_bits[FIELDS];
+    field_bits[ROW] = 64;
+    field_bits[RANK] = log2(ranks);
+    field_bits[BANK] = log2(banks);
+    field_bits[CHANNEL] = log2(channels);
+    field_bits[COLUMN] = log2(row_bytes / burst_bytes);
+    burst_bits = log2(burst_bytes);
+    vector<Field> order;
+    for (auto &name: mapping) {
+        auto it = find(field_names, field_names + FIELDS, name);
+        if (it == field_names + FIELDS || find(order.begin(), order.end(), it - field_names) != order.end())
+            throw ConfigError("unknown or repeated field " + name + " in address_mapping of dram");
+        order.push_back((Field)(it - field_names));
+    }
+    if (order.size() != FIELDS || order[0] != ROW)
+        throw ConfigError("address_mapping of dram must list row, rank, bank, channel and column, "
+            "starting with row");
+    int bit = burst_bits;
+    for (int i = FIELDS - 1; i >= 0; i--) {
+        shift[order[i]] = bit;
+        mask[order[i]] = order[i] == ROW ? ~0ULL : (1ULL << field_bits[order[i]]) - 1;
+        bit += field_bits[order[i]];
+    }
+
+    bank_state.resize(channels * ranks * banks);
+    bus_free.resize(channels);
+    reset();
+}
+
+void Dram::set_context(const AccessContext *ctx)
+{
+    context = ctx;
+}
+
+void Dram::reset()
+{
+    stats = {};
+    for (Bank& bank: bank_state)
+        bank.row = -1;
+    reset_timing();
+}
+
+void Dram::reset_timing()
+{
+    for (Bank& bank: bank_state)
+        bank = {bank.row, 0, 0, 0, 0, -1, 0, 0};
+    fill(bus_free.begin(), bus_free.end(), 0);
+    busy_until = 0;
+}
+
+uint64_t Dram::access(uintptr_t ptr, uint64_t now, bool is_write)
+{
+    auto field = [&](Field f) { return (ptr >> shift[f]) & mask[f]; };
+    size_t channel = field(CHANNEL);
+    Bank& bank = bank_state[(channel * ranks + field(RANK)) * banks + field(BANK)];
+    int64_t row = field(ROW);
+    uint64_t t = now + controller_cycles;
+
+    if (context->warming) {
+        uint64_t done = t + tCAS + tBURST;
+        if (bank.row != row)
+            done += tRCD + (bank.row < 0 ? 0 : tRP);
+        bank.row = open_page ? row : -1;
+        return done;
+    }
+
+    uint64_t cas;
+    if (bank.row == row) {
+        stats.row_hits++;
+        cas = max(t, bank.next_cas);
+        bank.next_cas = cas + tBURST;
+    } else if (fr_fcfs && bank.prev_row == row && max(t, bank.prev_next_cas) < bank.switched) {
+        // the row is still open, and the switch to the next waits for it
+        stats.row_hits++;
+        cas = max(t, bank.prev_next_cas);
+        bank.prev_next_cas = cas + tBURST;
+    } else {
+        uint64_t act;
+        if (bank.row < 0) {
+            stats.row_empty++;
+            act = max(t, bank.next_act);
+        } else {
+            stats.row_conflicts++;
+            uint64_t precharge = max({t, bank.activated + tRAS, bank.done});
+            bank.prev_row = bank.row;
+            bank.prev_next_cas = bank.next_cas;
+            bank.switched = precharge;
+            act = precharge + tRP;
+        }
+        bank.row = row;
+        bank.activated = act;
+        cas = act + tRCD;
+        bank.next_cas = cas + tBURST;
+    }
+
+    uint64_t data = max(cas + tCAS, bus_free[channel]);
+    uint64_t done = data + tBURST;
+    bus_free[channel] = done;
+    bank.done = max(bank.done, done);
+    if (!open_page) {
+        bank.next_act = max(bank.activated + tRAS, bank.done) + tRP;
+        bank.row = -1;
+    }
+
+    if (is_write)
+        stats.writes++;
+    else
+        stats.reads++;
+    stats.total_latency += done - now;
+    if (done > max(now, busy_until))
+        stats.busy_cycles += done - max(now, busy_until);
+    busy_until = max(busy_until, done);
+    return done;
+}
+
+// blocking accesses start in the current cycle of the pipeline
+int Dram::read(uintptr_t ptr)
+{
+    return access(ptr, context->cycle, false) - context->cycle;
+}
+
+int Dram::write(uintptr_t ptr)
+{
+    return access(ptr, context->cycle, true) - context->cycle;
+}
+
+uint64_t Dram::read_at(uintptr_t ptr, uint64_t& now)
+{
+    return access(ptr, now, false);
+}
+
+uint64_t Dram::write_at(uintptr_t ptr, uint64_t& now)
+{
+    return access(ptr, now, true);
+}
+
+DramStats Dram::get_stats() const
+{
+    return stats;
+}
+
+void Dram::set_stats(const DramStats& stats)
+{
+    this->stats = stats;
+}
+
+void Dram::print_info(uint64_t cycles) const
+{
+    uint64_t accesses = stats.reads + stats.writes;
+    printf("%20s: reads=%-10lu writes=%-10lu row_hit_rate=%.3f%%\n", "DRAM",
+        stats.reads, stats.writes, (double)stats.row_hits / accesses * 100);
+    printf("%20s  row_hits=%-10lu row_misses=%-10lu bank_conflicts=%lu\n", "",
+        stats.row_hits, stats.row_empty, stats.row_conflicts);
+    printf("%20s  average_latency=%.2f bandwidth=%.3f bytes/cycle busy=%.3f%%\n", "",
+        (double)stats.total_latency / accesses, (double)(accesses << burst_bits) / cycles,
+        (double)stats.busy_cycles / cycles * 100);
+}
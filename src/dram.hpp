@@ -0,0 +1,85 @@
+#ifndef DRAM_HPP
+#define DRAM_HPP
+
+#include <vector>
+#include <yaml-cpp/yaml.h>
+#include "cache.hpp"
+
+// the counters of a Dram, `busy_cycles` have an access in flight
+struct DramStats
+{
+    uint64_t reads, writes;
+    uint64_t row_hits, row_empty, row_conflicts;
+    uint64_t total_latency;
+    uint64_t busy_cycles;
+};
+
+/**
+ *  DRAM in place of the constant latency of Memory. An address is split
+ *  into row, rank, bank, channel and column fields in the configured order
+ *  above the offset of a burst. Each bank keeps a row open in its row
+ *  buffer with the open-page policy, or closes it after every access with
+ *  the closed-page policy, and each channel has a data bus. An access to
+ *  the open row needs a column command (tCAS), to a closed bank also an
+ *  activation (tRCD), and to another row a precharge first (tRP), no
+ *  earlier than tRAS after the activation. The burst then takes the bus
+ *  for tBURST. All times are in cycles of the processor.
+ *
+ *  The caches need the completion of an access when they issue it, so
+ *  requests are scheduled as they arrive. FR-FCFS lets an access to the
+ *  row a bank has open go before a row switch scheduled for an earlier
+ *  access but not started yet, while FCFS serves each bank in order.
+ *
+ *  During functional warming the cycle does not move, so the accesses
+ *  only open and close rows, and are neither scheduled nor counted.
+ */
+class Dram : public Storage
+{
+private:
+    enum Field { ROW, RANK, BANK, CHANNEL, COLUMN, FIELDS };
+    static const char *field_names[FIELDS];
+    int shift[FIELDS];
+    uint64_t mask[FIELDS];
+    int burst_bits;
+    int channels, ranks, banks;
+    int tRCD, tCAS, tRP, tRAS, tBURST, controller_cycles;
+    bool open_page, fr_fcfs;
+    const AccessContext *context;
+
+    struct Bank
+    {
+        int64_t row;            // the open row, or -1
+        uint64_t activated;     // when the row was opened
+        uint64_t next_cas;      // the first cycle of the next column command
+        uint64_t next_act;      // the first cycle a closed bank may activate
+        uint64_t done;          // the end of its last burst
+        // FR-FCFS: the row open before the last switch, which starts at
+        // `switched`, and its next column command
+        int64_t prev_row;
+        uint64_t prev_next_cas;
+        uint64_t switched;
+    };
+    std::vector<Bank> bank_state;   // of each channel, rank and bank
+    std::vector<uint64_t> bus_free; // the data bus of each channel
+    uint64_t busy_until;            // the end of the last burst
+
+    DramStats stats;
+
+    uint64_t access(uintptr_t ptr, uint64_t now, bool is_write);
+
+public:
+    Dram(const YAML::Node& config);
+    void set_context(const AccessContext *ctx);
+    void reset();
+    void reset_timing();  // forget the accesses in flight, the rows stay open
+    int read(uintptr_t ptr);
+    int write(uintptr_t ptr);
+    uint64_t read_at(uintptr_t ptr, uint64_t& now);
+    uint64_t write_at(uintptr_t ptr, uint64_t& now);
+    DramStats get_stats() const;
+    void set_stats(const DramStats& stats);
+    // the bandwidth is over the `cycles` elapsed
+    void print_info(uint64_t cycles) const;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstring>
 #include <cctype>
+#include <mutex>
 #include "elf_reader.hpp"
 using namespace std;
 
@@ -20,11 +21,10 @@ ElfReader::ElfReader(const string& _elf_filename)
     : elf_filename(_elf_filename)
 {
     elf_file = fopen(elf_filename.c_str(), "rb");
-    if (!elf_file) {
-        cerr << "error: cannot open " << elf_filename << endl;
-        exit(EXIT_FAILURE);
-    }
+    if (!elf_file)
+        throw runtime_error("cannot open " + elf_filename);
 
+    shstr = nullptr;
     try {
         fread_wrapper(&elf64_hdr, sizeof(elf64_hdr), 1, elf_file);
 
@@ -70,9 +70,10 @@ ElfReader::ElfReader(const string& _elf_filename)
             symtab[stradr + elf64_sym.st_name] = elf64_sym;
         }
         delete[] stradr;
-    } catch (const runtime_error& err) {
-        cerr << "error: " << err.what() << endl;
-        exit(EXIT_FAILURE);
+    } catch (const runtime_error&) {
+        delete[] shstr;
+        fclose(elf_file);
+        throw;
     }
 }
 
@@ -161,40 +162,26 @@ void ElfReader::output_elf_info(const string& info_filename)
     fclose(info_file);
 }
 
-void ElfReader::load_objdump(const string& objdump_path, InstructionMap& inst_map)
-{
-    string cmd = objdump_path + " -d " + elf_filename;
-    FILE *objdump_out = popen(cmd.c_str(), "r");
-
-    size_t n = 100;
-    char *line = new char[n];
-    char buf[100];
-    while (getline(&line, &n, objdump_out) > 0) {
-        int len = strlen(line);
-        if (len < 9 || line[8] != ':')
-            continue;
-        line[len - 1] = '\0';  // remove '\n'
-        uintptr_t addr = strtol(line, NULL, 16);
-        char *st = line + 20;
-        while (!isalpha(*st))
-            st++;
-        sprintf(buf, "%5lx:   ", addr);
-        inst_map[addr] = buf + string(st);
-    }
-    delete[] line;
-
-    pclose(objdump_out);
-}
+// the images of the programs loaded in this process, shared by the
+// simulators of a sweep
+static mutex images_lock;
+static map<string, weak_ptr<MemoryImage>> images;
 
 void ElfReader::load_elf(reg_t& pc, MemorySystem& mem_sys)
 {
-    try {
+    if (!image) {
+        lock_guard<mutex> guard(images_lock);
+        image = images[elf_filename].lock();
+    }
+    if (image) {
+        mem_sys.map_image(*image);
+    } else {
         for (const auto& elf64_phdr: program_header) {
             mem_sys.load_segment(elf_file, elf64_phdr);
         }
-    } catch (const runtime_error& err) {
-        cerr << "error: " << err.what() << endl;
-        exit(EXIT_FAILURE);
+        image = mem_sys.capture_image();
+        lock_guard<mutex> guard(images_lock);
+        images[elf_filename] = image;
     }
     pc = elf64_hdr.e_entry;
 }
@@ -9,8 +9,6 @@
 #include "memory_system.hpp"
 #include "elf.hpp"
 
-using InstructionMap = std::map<uintptr_t, std::string>;
-
 using SymbolTable = std::map<std::string, Elf64_Sym>;
 
 void fread_wrapper(void *ptr, size_t size, size_t nmemb, FILE *stream);
@@ -26,13 +24,15 @@ private:
     std::vector<Elf64_Shdr> section_header;
     char *shstr;
 
+    // the program as loaded, mapped again by the later loads
+    std::shared_ptr<MemoryImage> image;
+
 public:
     SymbolTable symtab;
 
     ElfReader(const std::string& elf_filename);
     ~ElfReader();
     void output_elf_info(const std::string& info_filename);
-    void load_objdump(const std::string& objdump_path, InstructionMap& inst_map);
     void load_elf(reg_t& pc, MemorySystem& mem_sys);
 };
 
@@ -0,0 +1,99 @@
+#ifndef EXECUTE_HELPERS_HPP
+#define EXECUTE_HELPERS_HPP
+
+#include "decode_helpers.hpp"
+
+inline reg_t alu_execute(ALU_OP alu_op, reg_t valA, reg_t valB)
+{
+    switch (alu_op) {
+    case ALU_ADD: return valA + valB;
+    case ALU_SUB: return valA - valB;
+    case ALU_MUL: return valA * valB;
+    case ALU_MULH: return ((__int128_t)valA * (__int128_t)valB) >> 64;
+    case ALU_MULHSU: return ((__int128_t)valA * (__uint128_t)valB) >> 64;
+    case ALU_MULHU: return ((__uint128_t)valA * (__uint128_t)valB) >> 64;
+    // division by zero and overflow do not trap in RISC-V
+    case ALU_DIV:
+        if (valB == 0)
+            return ~(reg_t)0;
+        if ((int64_t)valA == INT64_MIN && (int64_t)valB == -1)
+            return valA;
+        return (int64_t)valA / (int64_t)valB;
+    case ALU_DIVU: return valB == 0 ? ~(reg_t)0 : valA / valB;
+    case ALU_REM:
+        if (valB == 0)
+            return valA;
+        if ((int64_t)valA == INT64_MIN && (int64_t)valB == -1)
+            return 0;
+        return (int64_t)valA % (int64_t)valB;
+    case ALU_REMU: return valB == 0 ? valA : valA % valB;
+    case ALU_SLL: return valA << (valB & 0x3F);
+    case ALU_SRA: return (int64_t)valA >> (valB & 0x3F);
+    case ALU_SRL: return valA >> (valB & 0x3F);
+    case ALU_XOR: return valA ^ valB;
+    case ALU_OR: return valA | valB;
+    case ALU_AND: return valA & valB;
+    case ALU_SLT: return (int64_t)valA < (int64_t)valB;
+    case ALU_SLTU: return valA < valB;
+    default:
+        throw_error("unsupported ALU_OP: %d", alu_op);
+    }
+    return 0;
+}
+
+// ALU of addw, subw, ...: operate on the low 32 bits and sign extend
+inline reg_t alu_execute_w(ALU_OP alu_op, reg_t valA, reg_t valB)
+{
+    uint32_t a = valA, b = valB;
+    switch (alu_op) {
+    case ALU_SLL: a <<= b & 0x1F; break;
+    case ALU_SRA: a = (int32_t)a >> (b & 0x1F); break;
+    case ALU_SRL: a >>= b & 0x1F; break;
+    case ALU_DIV:
+        if (b == 0)
+            a = ~0U;
+        else if ((int32_t)a != INT32_MIN || (int32_t)b != -1)
+            a = (int32_t)a / (int32_t)b;
+        break;
+    case ALU_DIVU: a = b == 0 ? ~0U : a / b; break;
+    case ALU_REM:
+        if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+            a = 0;
+        else if (b != 0)
+            a = (int32_t)a % (int32_t)b;
+        break;
+    case ALU_REMU: a = b == 0 ? a : a % b; break;
+    default: a = alu_execute(alu_op, valA, valB);
+    }
+    return (int64_t)(int32_t)a;
+}
+
+inline bool branch_cond(uint8_t funct3, reg_t val1, reg_t val2)
+{
+    switch (funct3) {
+    case 0x0: return val1 == val2;
+    case 0x1: return val1 != val2;
+    case 0x4: return (int64_t)val1 < (int64_t)val2;
+    case 0x5: return (int64_t)val1 >= (int64_t)val2;
+    case 0x6: return val1 < val2;
+    case 0x7: return val1 >= val2;
+    }
+    return false;
+}
+
+// extend the value loaded by a load instruction with `funct3`
+inline reg_t load_extend(uint8_t funct3, reg_t val)
+{
+    if (funct3 < 4)
+        return sign_extend(val, 8 << funct3);
+    else
+        return zero_extend(val, 8 << (funct3 - 4));
+}
+
+// number of bytes accessed by a load/store instruction with `funct3`
+inline int access_bytes(uint8_t funct3)
+{
+    return 1 << (funct3 & 3);
+}
+
+#endif
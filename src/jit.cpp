@@ -0,0 +1,658 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <sys/mman.h>
+#include "jit.hpp"
+#include "execute_helpers.hpp"
+using namespace std;
+
+enum exit_reason_t
+{
+    EXIT_NORMAL = 0,
+    EXIT_FAULT,
+    EXIT_CODE_WRITE
+};
+
+enum x86_reg_t
+{
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    NO_INDEX = -1
+};
+
+// condition codes of jcc/setcc
+enum x86_cc_t
+{
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD
+};
+
+#define STATE_OFF(field) ((int32_t)offsetof(Jit::State, field))
+#define REG_OFF(r) ((int32_t)(r) * 8)
+
+/**
+ *  A minimal x86-64 assembler. `rbx` holds the address of the guest
+ *  registers and `rbp` the address of the JIT state while translated
+ *  code runs; everything else is scratch.
+ */
+class Emitter
+{
+private:
+    uint8_t *p;
+
+public:
+    struct Label
+    {
+        uint8_t *target = nullptr;
+        std::vector<uint8_t*> fixups;
+    };
+
+    Emitter(uint8_t *p) : p(p) {}
+    uint8_t* cur() const { return p; }
+
+    void byte(uint8_t b) { *p++ = b; }
+    void bytes(std::initializer_list<uint8_t> bs) { for (auto b: bs) byte(b); }
+    void u32(uint32_t v) { memcpy(p, &v, 4); p += 4; }
+    void u64(uint64_t v) { memcpy(p, &v, 8); p += 8; }
+
+    // ModRM (and SIB) for [base + index + disp32]
+    void mem(int reg, int base, int index, int32_t disp)
+    {
+        if (index == NO_INDEX && base != RSP) {
+            byte(0x80 | reg << 3 | base);
+        } else {
+            byte(0x80 | reg << 3 | 4);
+            byte((index == NO_INDEX ? 4 : index) << 3 | base);
+        }
+        u32(disp);
+    }
+
+    void rr(uint8_t op, int reg, int rm) { bytes({0x48, op, (uint8_t)(0xC0 | reg << 3 | rm)}); }
+
+    void load64(int r, int base, int index, int32_t disp) { bytes({0x48, 0x8B}); mem(r, base, index, disp); }
+    void store64(int r, int base, int index, int32_t disp) { bytes({0x48, 0x89}); mem(r, base, index, disp); }
+    void load_reg(int r, reg_num_t guest) { load64(r, RBX, NO_INDEX, REG_OFF(guest)); }
+    void store_reg(int r, reg_num_t guest) { store64(r, RBX, NO_INDEX, REG_OFF(guest)); }
+
+    // load with the extension of a load instruction with `funct3`
+    void load_ext(uint8_t funct3, int r, int base, int index)
+    {
+        switch (funct3) {
+        case 0: bytes({0x48, 0x0F, 0xBE}); break;  // movsx r64, byte
+        case 1: bytes({0x48, 0x0F, 0xBF}); break;  // movsx r64, word
+        case 2: bytes({0x48, 0x63}); break;        // movsxd r64, dword
+        case 4: bytes({0x48, 0x0F, 0xB6}); break;  // movzx r64, byte
+        case 5: bytes({0x48, 0x0F, 0xB7}); break;  // movzx r64, word
+        case 6: byte(0x8B); break;                 // mov r32, dword
+        default: bytes({0x48, 0x8B}); break;       // mov r64, qword
+        }
+        mem(r, base, index, 0);
+    }
+
+    // store the low `bytes` bytes of `r`, which must be one of rax-rbx
+    void store_sized(int bytes_num, int r, int base, int index)
+    {
+        switch (bytes_num) {
+        case 1: byte(0x88); break;
+        case 2: bytes({0x66, 0x89}); break;
+        case 4: byte(0x89); break;
+        default: bytes({0x48, 0x89}); break;
+        }
+        mem(r, base, index, 0);
+    }
+
+    void mov_imm(int r, uint64_t imm)
+    {
+        if ((int64_t)imm == (int32_t)imm) {
+            bytes({0x48, 0xC7, (uint8_t)(0xC0 | r)});
+            u32((uint32_t)imm);
+        } else {
+            bytes({0x48, (uint8_t)(0xB8 | r)});
+            u64(imm);
+        }
+    }
+
+    void lea_disp(int r, int base, int32_t disp) { bytes({0x48, 0x8D}); mem(r, base, NO_INDEX, disp); }
+
+    void jmp_abs(const uint8_t *target)
+    {
+        byte(0xE9);
+        u32((uint32_t)(target - (p + 4)));
+    }
+
+    void call_abs(const void *fn)
+    {
+        mov_imm(RAX, (uint64_t)fn);
+        bytes({0xFF, 0xD0});  // call rax
+    }
+
+    // return the address of the rel32 to be patched
+    uint8_t* jcc(int cc, Label& label)
+    {
+        bytes({0x0F, (uint8_t)(0x80 | cc)});
+        return rel32(label);
+    }
+
+    uint8_t* jmp(Label& label)
+    {
+        byte(0xE9);
+        return rel32(label);
+    }
+
+    uint8_t* rel32(Label& label)
+    {
+        uint8_t *site = p;
+        if (label.target)
+            u32((uint32_t)(label.target - (p + 4)));
+        else {
+            label.fixups.push_back(p);
+            u32(0);
+        }
+        return site;
+    }
+
+    void bind(Label& label)
+    {
+        label.target = p;
+        for (auto site: label.fixups)
+            *(int32_t*)site = (int32_t)(p - (site + 4));
+        label.fixups.clear();
+    }
+
+    // add/sub/cmp qword [rbp + disp], imm32
+    void state_imm(int ext, int32_t disp, int32_t imm)
+    {
+        bytes({0x48, 0x81});
+        mem(ext, RBP, NO_INDEX, disp);
+        u32(imm);
+    }
+
+    void set_reason(uint64_t reason)
+    {
+        bytes({0x48, 0xC7});
+        mem(0, RBP, NO_INDEX, STATE_OFF(reason));
+        u32((uint32_t)reason);
+    }
+};
+
+/**
+ *  Called from translated code, so no exception may escape from them
+ */
+struct JitHelpers
+{
+    struct LoadResult
+    {
+        reg_t value;
+        uint64_t fault;
+    };
+
+    static void fill_tlb(Jit::TlbEntry *tlb, uintptr_t va, pte_t pte)
+    {
+        auto& entry = tlb[(va >> 12) & (JIT_TLB_SIZE - 1)];
+        entry.vpn = va >> 12;
+        entry.host_page = PTE_ADDR(pte);
+    }
+
+    static LoadResult load(Jit::State *state, reg_t addr, int funct3)
+    {
+        auto& mem_sys = state->jit->mem_sys;
+        int bytes = access_bytes(funct3);
+        reg_t val;
+        try {
+            val = mem_sys.load(addr, bytes);
+        } catch (const runtime_error&) {
+            return {0, 1};
+        }
+        if (PGOFF(addr) <= PGSIZE - bytes)
+            fill_tlb(state->load_tlb, addr, mem_sys.lookup_pte(addr));
+        return {load_extend(funct3, val), 0};
+    }
+
+    static uint64_t store(Jit::State *state, reg_t addr, reg_t val, int bytes)
+    {
+        auto jit = state->jit;
+        jit->code_written = false;
+        try {
+            jit->mem_sys.store(addr, val, bytes);
+        } catch (const runtime_error&) {
+            return EXIT_FAULT;
+        }
+        if (jit->code_written)
+            return EXIT_CODE_WRITE;
+        pte_t pte = jit->mem_sys.lookup_pte(addr);
+        if (PGOFF(addr) <= PGSIZE - bytes && !(pte & PTE_CODE))
+            fill_tlb(state->store_tlb, addr, pte);
+        return EXIT_NORMAL;
+    }
+
+    static reg_t alu(int alu_op, reg_t valA, reg_t valB)
+    {
+        return alu_execute((ALU_OP)alu_op, valA, valB);
+    }
+
+    static reg_t alu_w(int alu_op, reg_t valA, reg_t valB)
+    {
+        return alu_execute_w((ALU_OP)alu_op, valA, valB);
+    }
+};
+
+/**
+ *  Translation of one block, with the cold paths (slow memory accesses
+ *  and exits) emitted after the straight-line code
+ */
+struct BlockTranslator
+{
+    Emitter& as;
+    const uint8_t *epilogue;
+    std::vector<std::function<void()>> cold;
+
+    BlockTranslator(Emitter& as, const uint8_t *epilogue)
+        : as(as), epilogue(epilogue)
+    {}
+
+    // leave translated code with `pc` as the next pc, giving back
+    // `unexecuted` instructions to the budget
+    void exit_to(reg_t pc, unsigned unexecuted, uint64_t reason)
+    {
+        if (unexecuted)
+            as.state_imm(0, STATE_OFF(budget), unexecuted);
+        if (reason != EXIT_NORMAL)
+            as.set_reason(reason);
+        as.mov_imm(RAX, pc);
+        as.jmp_abs(epilogue);
+    }
+
+    // compute the address of a load/store into rsi, and look it up in
+    // `tlb`, leaving the page offset in rax and the entry index in rcx
+    void tlb_lookup(const EXReg& r, int32_t tlb_off, int bytes_num, Emitter::Label& slow)
+    {
+        as.load_reg(RSI, r.rs1);
+        if (r.imm)
+            as.lea_disp(RSI, RSI, (int32_t)r.imm);
+        as.rr(0x89, RSI, RAX);                     // mov rax, rsi
+        as.bytes({0x48, 0xC1, 0xE8, 0x0C});        // shr rax, 12
+        as.bytes({0x89, 0xC1});                    // mov ecx, eax
+        as.bytes({0x81, 0xE1});                    // and ecx, JIT_TLB_SIZE - 1
+        as.u32(JIT_TLB_SIZE - 1);
+        as.bytes({0xC1, 0xE1, 0x04});              // shl ecx, 4
+        as.bytes({0x48, 0x3B});                    // cmp rax, tlb[rcx].vpn
+        as.mem(RAX, RBP, RCX, tlb_off);
+        as.jcc(CC_NE, slow);
+        as.bytes({0x89, 0xF0});                    // mov eax, esi
+        as.byte(0x25);                             // and eax, 0xFFF
+        as.u32(PGSIZE - 1);
+        as.byte(0x3D);                             // cmp eax, PGSIZE - bytes
+        as.u32(PGSIZE - bytes_num);
+        as.jcc(CC_A, slow);                        // across the page
+    }
+
+    void translate_load(const EXReg& r, reg_t pc, unsigned index, unsigned length)
+    {
+        auto slow = std::make_shared<Emitter::Label>();
+        auto done = std::make_shared<Emitter::Label>();
+        int32_t tlb_off = STATE_OFF(load_tlb);
+        tlb_lookup(r, tlb_off, access_bytes(r.funct3), *slow);
+        as.load64(RDX, RBP, RCX, tlb_off + 8);
+        as.load_ext(r.funct3, RAX, RDX, RAX);
+        as.bind(*done);
+        if (r.rd != 0)
+            as.store_reg(RAX, r.rd);
+
+        uint8_t funct3 = r.funct3;
+        cold.push_back([=]() {
+            as.bind(*slow);
+            as.rr(0x89, RBP, RDI);                 // mov rdi, rbp
+            as.bytes({0xBA});                      // mov edx, funct3
+            as.u32(funct3);
+            as.call_abs((void*)JitHelpers::load);
+            as.rr(0x85, RDX, RDX);                 // test rdx, rdx
+            Emitter::Label fault;
+            as.jcc(CC_NE, fault);
+            as.jmp(*done);
+            as.bind(fault);
+            exit_to(pc, length - index, EXIT_FAULT);
+        });
+    }
+
+    void translate_store(const EXReg& r, reg_t pc, reg_t next_pc, unsigned index, unsigned length)
+    {
+        auto slow = std::make_shared<Emitter::Label>();
+        auto done = std::make_shared<Emitter::Label>();
+        int32_t tlb_off = STATE_OFF(store_tlb);
+        int bytes_num = access_bytes(r.funct3);
+        as.load_reg(RDX, r.rs2);
+        tlb_lookup(r, tlb_off, bytes_num, *slow);
+        as.load64(RDI, RBP, RCX, tlb_off + 8);
+        as.store_sized(bytes_num, RDX, RDI, RAX);
+        as.bind(*done);
+
+        cold.push_back([=]() {
+            as.bind(*slow);
+            as.rr(0x89, RBP, RDI);                 // mov rdi, rbp
+            as.byte(0xB9);                         // mov ecx, bytes
+            as.u32(bytes_num);
+            as.call_abs((void*)JitHelpers::store);
+            as.bytes({0x85, 0xC0});                // test eax, eax
+            as.jcc(CC_E, *done);
+            as.bytes({0x83, 0xF8, EXIT_CODE_WRITE});  // cmp eax, EXIT_CODE_WRITE
+            Emitter::Label fault;
+            as.jcc(CC_NE, fault);
+            // the store may have changed code translated after it
+            exit_to(next_pc, length - index - 1, EXIT_CODE_WRITE);
+            as.bind(fault);
+            exit_to(pc, length - index, EXIT_FAULT);
+        });
+    }
+
+    void translate_alu(const EXReg& r, reg_t pc)
+    {
+        if (r.rd == 0)
+            return;
+        if (r.opcode == OP_AUIPC) {
+            as.mov_imm(RAX, pc + r.imm);
+            as.store_reg(RAX, r.rd);
+            return;
+        }
+
+        bool word = r.opcode == OP_RIW || r.opcode == OP_RRW;
+        as.load_reg(RAX, r.rs1);
+        if (r.opcode == OP_RR || r.opcode == OP_RRW)
+            as.load_reg(RCX, r.rs2);
+        else
+            as.mov_imm(RCX, r.imm);
+
+        switch (r.alu_op) {
+        case ALU_ADD: as.rr(0x01, RCX, RAX); break;
+        case ALU_SUB: as.rr(0x29, RCX, RAX); break;
+        case ALU_XOR: as.rr(0x31, RCX, RAX); break;
+        case ALU_OR: as.rr(0x09, RCX, RAX); break;
+        case ALU_AND: as.rr(0x21, RCX, RAX); break;
+        case ALU_MUL: as.bytes({0x48, 0x0F, 0xAF, 0xC1}); break;  // imul rax, rcx
+        case ALU_SLL:
+        case ALU_SRL:
+        case ALU_SRA:
+            // sllw, ... shift eax, which also masks the count to 5 bits
+            if (!word)
+                as.byte(0x48);
+            as.byte(0xD3);                                         // shl/shr/sar rax, cl
+            as.byte(r.alu_op == ALU_SLL ? 0xE0 : r.alu_op == ALU_SRL ? 0xE8 : 0xF8);
+            break;
+        case ALU_SLT:
+        case ALU_SLTU:
+            as.rr(0x39, RCX, RAX);                                 // cmp rax, rcx
+            as.bytes({0x0F, (uint8_t)(r.alu_op == ALU_SLT ? 0x9C : 0x92), 0xC0});  // setl/setb al
+            as.bytes({0x0F, 0xB6, 0xC0});                          // movzx eax, al
+            break;
+        default:
+            // mulh, div and rem go through the interpreter's ALU
+            as.rr(0x89, RAX, RSI);                                 // mov rsi, rax
+            as.rr(0x89, RCX, RDX);                                 // mov rdx, rcx
+            as.byte(0xBF);                                         // mov edi, alu_op
+            as.u32(r.alu_op);
+            as.call_abs(word ? (void*)JitHelpers::alu_w : (void*)JitHelpers::alu);
+        }
+
+        // truncate for addw, subw, ...
+        if (word)
+            as.bytes({0x48, 0x63, 0xC0});                          // movsxd rax, eax
+        as.store_reg(RAX, r.rd);
+    }
+
+    void translate_branch(const EXReg& r, reg_t pc, reg_t next_pc)
+    {
+        int cc;
+        switch (r.funct3) {
+        case 0x0: cc = CC_E; break;
+        case 0x1: cc = CC_NE; break;
+        case 0x4: cc = CC_L; break;
+        case 0x5: cc = CC_GE; break;
+        case 0x6: cc = CC_B; break;
+        case 0x7: cc = CC_AE; break;
+        default: cc = -1;  // never taken
+        }
+        if (cc >= 0) {
+            as.load_reg(RAX, r.rs1);
+            as.bytes({0x48, 0x3B});                                // cmp rax, reg[rs2]
+            as.mem(RAX, RBX, NO_INDEX, REG_OFF(r.rs2));
+            auto taken = std::make_shared<Emitter::Label>();
+            uint8_t *site = as.jcc(cc, *taken);
+            link_exit(taken, pc + r.imm, site);
+        }
+        auto fall = std::make_shared<Emitter::Label>();
+        uint8_t *site = as.jmp(*fall);
+        link_exit(fall, next_pc, site);
+    }
+
+    // a direct exit to `target` from the branch whose rel32 is at `site`,
+    // which is patched to jump into the translated target later
+    void link_exit(std::shared_ptr<Emitter::Label> label, reg_t target, uint8_t *site)
+    {
+        cold.push_back([=]() {
+            as.bind(*label);
+            as.mov_imm(RAX, target);
+            as.mov_imm(RDX, (uint64_t)site);
+            as.store64(RDX, RBP, NO_INDEX, STATE_OFF(link_site));
+            as.jmp_abs(epilogue);
+        });
+    }
+
+    void translate_jal(const EXReg& r, reg_t pc, reg_t next_pc)
+    {
+        if (r.rd != 0) {
+            as.mov_imm(RAX, next_pc);
+            as.store_reg(RAX, r.rd);
+        }
+        auto label = std::make_shared<Emitter::Label>();
+        uint8_t *site = as.jmp(*label);
+        link_exit(label, pc + r.imm, site);
+    }
+
+    void translate_jalr(const EXReg& r, reg_t next_pc)
+    {
+        as.load_reg(RAX, r.rs1);
+        if (r.imm)
+            as.lea_disp(RAX, RAX, (int32_t)r.imm);
+        if (r.rd != 0) {
+            as.mov_imm(RCX, next_pc);
+            as.store_reg(RCX, r.rd);
+        }
+        as.jmp_abs(epilogue);
+    }
+
+};
+
+Jit::Jit(MemorySystem& mem_sys, reg_t *reg)
+    : mem_sys(mem_sys), reg(reg), code_written(false), generation(0)
+{
+    void *buf = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+        throw_error("cannot allocate the code buffer of the JIT: %s", strerror(errno));
+    code_buffer = (uint8_t*)buf;
+    state.jit = this;
+    reset_code_buffer();
+}
+
+Jit::~Jit()
+{
+    for (const auto &pr: blocks)
+        delete pr.second;
+    munmap(code_buffer, JIT_CODE_SIZE);
+}
+
+void Jit::reset_code_buffer()
+{
+    for (const auto &pr: blocks)
+        delete pr.second;
+    blocks.clear();
+    page_blocks.clear();
+    memset(fast_lookup, 0, sizeof(fast_lookup));
+    generation++;
+
+    Emitter as(code_buffer);
+    // reg_t entry(reg_t *reg, State *state, const uint8_t *code)
+    entry = as.cur();
+    as.bytes({0x53, 0x55});                    // push rbx; push rbp
+    as.bytes({0x48, 0x83, 0xEC, 0x08});        // sub rsp, 8
+    as.bytes({0x48, 0x89, 0xFB});              // mov rbx, rdi
+    as.bytes({0x48, 0x89, 0xF5});              // mov rbp, rsi
+    as.bytes({0xFF, 0xE2});                    // jmp rdx
+    // return the next pc in rax
+    epilogue = as.cur();
+    as.bytes({0x48, 0x83, 0xC4, 0x08});        // add rsp, 8
+    as.bytes({0x5D, 0x5B, 0xC3});              // pop rbp; pop rbx; ret
+    code_ptr = as.cur();
+}
+
+void Jit::flush_tlb()
+{
+    for (int i = 0; i < JIT_TLB_SIZE; i++) {
+        state.load_tlb[i].vpn = -1;
+        state.store_tlb[i].vpn = -1;
+    }
+}
+
+Jit::Block* Jit::lookup(reg_t pc)
+{
+    auto& fast = fast_lookup[(pc >> 1) & (JIT_FAST_SIZE - 1)];
+    if (fast && fast->pc == pc)
+        return fast;
+    auto it = blocks.find(pc);
+    Block *block = it != blocks.end() ? it->second : translate(pc);
+    if (block)
+        fast = block;
+    return block;
+}
+
+Jit::Block* Jit::translate(reg_t pc)
+{
+    // decode until a branch or jump, staying within the page
+    std::vector<std::pair<EXReg, reg_t>> insts;
+    reg_t cur = pc;
+    while (insts.size() < JIT_MAX_BLOCK && PGADDR(cur) == PGADDR(pc)) {
+        EXReg r = {};
+        try {
+            parse_inst(mem_sys.fetch_inst(cur), r);
+        } catch (const runtime_error&) {
+            break;
+        }
+        int len = r.compressed_inst ? 2 : 4;
+        if (r.opcode == OP_ECALL || PGOFF(cur) > PGSIZE - len)
+            break;
+        insts.emplace_back(r, cur);
+        cur += len;
+        if (r.opcode == OP_BRANCH || r.opcode == OP_JAL || r.opcode == OP_JALR)
+            break;
+    }
+    if (insts.empty())
+        return nullptr;
+
+    // the largest block takes well below this
+    if (code_ptr + (64 << 10) > code_buffer + JIT_CODE_SIZE)
+        reset_code_buffer();
+
+    Emitter as(code_ptr);
+    BlockTranslator t(as, epilogue);
+    unsigned length = insts.size();
+    uint8_t *code = as.cur();
+
+    auto budget_exit = std::make_shared<Emitter::Label>();
+    as.state_imm(7, STATE_OFF(budget), length);     // cmp budget, length
+    as.jcc(CC_B, *budget_exit);
+    as.state_imm(5, STATE_OFF(budget), length);     // sub budget, length
+    t.cold.push_back([&t, budget_exit, pc]() {
+        t.as.bind(*budget_exit);
+        t.exit_to(pc, 0, EXIT_NORMAL);
+    });
+
+    for (unsigned i = 0; i < length; i++) {
+        const EXReg& r = insts[i].first;
+        reg_t inst_pc = insts[i].second;
+        reg_t next_pc = inst_pc + (r.compressed_inst ? 2 : 4);
+        switch (r.opcode) {
+        case OP_LOAD: t.translate_load(r, inst_pc, i, length); break;
+        case OP_STORE: t.translate_store(r, inst_pc, next_pc, i, length); break;
+        case OP_BRANCH: t.translate_branch(r, inst_pc, next_pc); break;
+        case OP_JAL: t.translate_jal(r, inst_pc, next_pc); break;
+        case OP_JALR: t.translate_jalr(r, next_pc); break;
+        default: t.translate_alu(r, inst_pc);
+        }
+    }
+    uint8_t last = insts.back().first.opcode;
+    if (last != OP_BRANCH && last != OP_JAL && last != OP_JALR) {
+        auto label = std::make_shared<Emitter::Label>();
+        uint8_t *site = as.jmp(*label);
+        t.link_exit(label, cur, site);
+    }
+    for (auto& emit_cold: t.cold)
+        emit_cold();
+    code_ptr = as.cur();
+
+    auto block = new Block{pc, length, code, {}};
+    blocks[pc] = block;
+    page_blocks[PGADDR(pc)].push_back(block);
+    mem_sys.mark_code_page(pc);
+    state.store_tlb[(pc >> 12) & (JIT_TLB_SIZE - 1)].vpn = -1;
+    return block;
+}
+
+void Jit::link(uint8_t *site, reg_t target)
+{
+    unsigned gen = generation;
+    Block *block = lookup(target);
+    if (!block || generation != gen)
+        return;
+    uint8_t *old = site + 4 + *(int32_t*)site;
+    *(int32_t*)site = (int32_t)(block->code - (site + 4));
+    block->incoming.emplace_back(site, old);
+}
+
+void Jit::remove_block(Block *block)
+{
+    for (const auto &pr: block->incoming)
+        *(int32_t*)pr.first = (int32_t)(pr.second - (pr.first + 4));
+    auto& fast = fast_lookup[(block->pc >> 1) & (JIT_FAST_SIZE - 1)];
+    if (fast == block)
+        fast = nullptr;
+    blocks.erase(block->pc);
+    delete block;
+}
+
+size_t Jit::run(reg_t& pc, size_t max_inst)
+{
+    auto entry_fn = (reg_t (*)(reg_t*, State*, const uint8_t*))entry;
+
+    // the page table may have changed since the last run
+    flush_tlb();
+    state.budget = max_inst;
+    while (true) {
+        Block *block = lookup(pc);
+        if (!block || block->length > state.budget)
+            break;
+        state.reason = EXIT_NORMAL;
+        state.link_site = nullptr;
+        pc = entry_fn(reg, &state, block->code);
+        if (state.reason == EXIT_FAULT)
+            break;
+        if (state.link_site)
+            link(state.link_site, pc);
+    }
+    return max_inst - state.budget;
+}
+
+void Jit::invalidate_code_page(uintptr_t va)
+{
+    code_written = true;
+    auto it = page_blocks.find(PGADDR(va));
+    if (it == page_blocks.end())
+        return;
+    for (auto block: it->second)
+        remove_block(block);
+    page_blocks.erase(it);
+}
+
+void Jit::invalidate_all_code()
+{
+    reset_code_buffer();
+}
@@ -0,0 +1,87 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <unordered_map>
+#include <vector>
+#include "register_def.hpp"
+#include "memory_system.hpp"
+
+#define JIT_CODE_SIZE   (32 << 20)
+#define JIT_TLB_SIZE    256
+#define JIT_FAST_SIZE   4096
+#define JIT_MAX_BLOCK   64
+
+/**
+ *  Translate basic blocks of guest code into x86-64 code for the functional
+ *  model. Guest registers stay in the simulator's `reg[]` array, and memory
+ *  is accessed through a small TLB of host page pointers filled from the
+ *  memory system's page table. Blocks end at a branch or jump, and jump
+ *  directly into each other once their targets are translated.
+ *
+ *  Instructions that are not translated (ecall, or anything that cannot be
+ *  decoded) and accesses that fault are left to the interpreter.
+ */
+class Jit : public CodeObserver
+{
+public:
+    struct TlbEntry
+    {
+        uint64_t vpn;
+        uintptr_t host_page;
+    };
+
+    struct State
+    {
+        uint64_t budget;  // instructions left to execute
+        uint64_t reason;  // why the last block exited
+        uint8_t *link_site;  // branch to patch once its target is translated
+        Jit *jit;
+        TlbEntry load_tlb[JIT_TLB_SIZE];
+        TlbEntry store_tlb[JIT_TLB_SIZE];
+    };
+
+private:
+    struct Block
+    {
+        reg_t pc;
+        unsigned length;
+        uint8_t *code;
+        // branches of other blocks jumping here, and where they jumped before
+        std::vector<std::pair<uint8_t*, uint8_t*>> incoming;
+    };
+
+    MemorySystem& mem_sys;
+    reg_t *reg;
+    State state;
+    bool code_written;
+
+    uint8_t *code_buffer, *code_ptr;
+    uint8_t *entry, *epilogue;
+    std::unordered_map<reg_t, Block*> blocks;
+    std::unordered_map<uintptr_t, std::vector<Block*>> page_blocks;
+    Block *fast_lookup[JIT_FAST_SIZE];
+    unsigned generation;
+
+    Block* lookup(reg_t pc);
+    Block* translate(reg_t pc);
+    void link(uint8_t *site, reg_t target);
+    void remove_block(Block *block);
+    void flush_tlb();
+    void reset_code_buffer();
+
+    friend struct JitHelpers;
+
+public:
+    Jit(MemorySystem& mem_sys, reg_t *reg);
+    ~Jit();
+
+    // run translated code from `pc` for at most `max_inst` instructions,
+    // leave the pc of the next instruction in `pc` and return the number
+    // of instructions executed
+    size_t run(reg_t& pc, size_t max_inst);
+
+    void invalidate_code_page(uintptr_t va);
+    void invalidate_all_code();
+};
+
+#endif
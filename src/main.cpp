@@ -5,6 +5,9 @@
 #include <utility>
 #include <yaml-cpp/yaml.h>
 #include "simulator.hpp"
+#include "sweep.hpp"
+#include "trace.hpp"
+#include "stack_distance.hpp"
 using namespace std;
 
 void print_help_and_exit(string name)
@@ -18,6 +21,31 @@ void print_help_and_exit(string name)
     cerr << "  -s                       Single step mode" << endl;
     cerr << "  -i, --info info_file     Output filename of Elf information" << endl;
     cerr << "  -v                       Verbose mode" << endl;
+    cerr << "  -f, --fast-forward N     Run the first N instructions in the functional" << endl;
+    cerr << "                           model before starting the pipeline" << endl;
+    cerr << "  --roi                    Fast-forward until the program calls roi_begin()," << endl;
+    cerr << "                           then N more instructions if -f is also given" << endl;
+    cerr << "  --jit                    Translate guest code to x86-64 when fast-forwarding" << endl;
+    cerr << "  --simpoint-profile file  Profile basic block vectors in the functional model," << endl;
+    cerr << "                           and write the representative intervals to file" << endl;
+    cerr << "  --simpoints file         Simulate only the representative intervals in file" << endl;
+    cerr << "                           in the pipeline, and estimate the whole program" << endl;
+    cerr << "  --smarts                 Sample short windows in the pipeline periodically," << endl;
+    cerr << "                           with confidence intervals on the results" << endl;
+    cerr << "  --save-checkpoint file   Save the state after fast-forwarding to file and stop" << endl;
+    cerr << "  --restore-checkpoint file" << endl;
+    cerr << "                           Start from the state saved in file instead of" << endl;
+    cerr << "                           loading the ELF file" << endl;
+    cerr << "  --record-trace file      Record the accesses to the caches to file, as a" << endl;
+    cerr << "                           binary trace to be replayed in trace mode" << endl;
+    cerr << "  --count-allocations      Report the heap allocations made while the" << endl;
+    cerr << "                           pipeline runs" << endl;
+    cerr << "  --sweep sweep_file       Simulate the configurations listed in sweep_file" << endl;
+    cerr << "                           in parallel, and write their results to a table" << endl;
+    cerr << "Options for trace_file:" << endl;
+    cerr << "  --stack-distance         Print the miss rates of LRU caches of every size" << endl;
+    cerr << "                           and associativity, from one pass over the trace" << endl;
+    cerr << "  --convert-trace file     Convert a text trace to the binary format in file" << endl;
     cerr << endl;
     exit(EXIT_FAILURE);
 }
@@ -29,6 +57,19 @@ int main(int argc, char **argv)
         {"help", no_argument, 0, 'h'},
         {"config", required_argument, 0, 'c'},
         {"info",   required_argument, 0, 'i'},
+        {"fast-forward", required_argument, 0, 'f'},
+        {"roi", no_argument, 0, 'r'},
+        {"jit", no_argument, 0, 'j'},
+        {"simpoint-profile", required_argument, 0, 'P'},
+        {"simpoints", required_argument, 0, 'S'},
+        {"smarts", no_argument, 0, 'M'},
+        {"save-checkpoint", required_argument, 0, 'C'},
+        {"restore-checkpoint", required_argument, 0, 'R'},
+        {"sweep", required_argument, 0, 'W'},
+        {"record-trace", required_argument, 0, 'T'},
+        {"convert-trace", required_argument, 0, 'O'},
+        {"stack-distance", no_argument, 0, 'D'},
+        {"count-allocations", no_argument, 0, 'A'},
         {0, 0, 0, 0}
     };
     int opt, option_index;
@@ -36,7 +77,7 @@ int main(int argc, char **argv)
     YAML::Node option;
 
     while ((opt =
-        getopt_long(argc, argv, "svi:c:h", long_options, &option_index)) != -1) {
+        getopt_long(argc, argv, "svi:c:f:h", long_options, &option_index)) != -1) {
         switch (opt) {
         case 'c':
             config_filename = optarg;
@@ -50,6 +91,45 @@ int main(int argc, char **argv)
         case 'v':
             option["verbose"] = true;
             break;
+        case 'f':
+            option["fast_forward"] = stoull(optarg, nullptr, 0);
+            break;
+        case 'r':
+            option["roi"] = true;
+            break;
+        case 'j':
+            option["jit"] = true;
+            break;
+        case 'P':
+            option["simpoint_profile"] = string(optarg);
+            break;
+        case 'S':
+            option["simpoints"] = string(optarg);
+            break;
+        case 'M':
+            option["smarts"] = true;
+            break;
+        case 'C':
+            option["save_checkpoint"] = string(optarg);
+            break;
+        case 'R':
+            option["restore_checkpoint"] = string(optarg);
+            break;
+        case 'W':
+            option["sweep"] = string(optarg);
+            break;
+        case 'D':
+            option["stack_distance"] = true;
+            break;
+        case 'T':
+            option["record_trace"] = string(optarg);
+            break;
+        case 'O':
+            option["convert_trace"] = string(optarg);
+            break;
+        case 'A':
+            option["count_allocations"] = true;
+            break;
         case 'h':
         default:
             print_help_and_exit(argv[0]);
@@ -78,12 +158,35 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (elf_file.size() >= 6 && elf_file.substr(elf_file.size() - 6) == ".trace") {
-        MemorySystem mem_sys(config["cache"], config["memory_cycles"].as<int>(100));
-        mem_sys.run_trace(elf_file);
-    } else {
-        Simulator simulator(option, config, move(args));
-        simulator.start();
+    bool is_trace = elf_file.size() >= 6 && elf_file.substr(elf_file.size() - 6) == ".trace";
+    try {
+        if (is_trace && option["stack_distance"]) {
+            StackDistanceAnalyzer analyzer(config["stack_distance"] ?
+                config["stack_distance"] : YAML::Node(YAML::NodeType::Map));
+            TraceReader reader(elf_file);
+            TraceKind kind;
+            uint64_t addr;
+            int bytes;
+            while (reader.next(kind, addr, bytes))
+                if (kind != TRACE_INST)
+                    analyzer.access(addr);
+            analyzer.print_info();
+        } else if (is_trace && option["convert_trace"]) {
+            convert_trace(elf_file, option["convert_trace"].as<string>());
+        } else if (is_trace) {
+            MemorySystem mem_sys(config["cache"], config["memory_cycles"].as<int>(100), "page_table",
+                false, config["dram"]);
+            mem_sys.run_trace(elf_file);
+        } else if (option["sweep"]) {
+            run_sweep(option["sweep"].as<string>(), config_filename, config, option, args);
+        } else {
+            Simulator simulator(option, config, move(args));
+            simulator.start();
+        }
+    } catch (const runtime_error& err) {
+        // bad configurations, and files that cannot be loaded
+        cerr << "error: " << err.what() << endl;
+        exit(EXIT_FAILURE);
     }
 
     return 0;
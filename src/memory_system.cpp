@@ -1,21 +1,83 @@
 #include <cstring>
 #include <cassert>
+#include <csignal>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <new>
 #include <map>
-#include <fstream>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 #include <iostream>
 #include "memory_system.hpp"
 #include "elf_reader.hpp"
+#include "checkpoint.hpp"
+#include "trace.hpp"
 using namespace std;
 
-MemorySystem::MemorySystem(const YAML::Node& cache_list, int memory_cycles)
+// the memory systems with a flat window, searched by the SIGSEGV handler
+#define MAX_FLAT_WINDOWS 256
+static atomic<MemorySystem*> flat_windows[MAX_FLAT_WINDOWS];
+static struct sigaction default_segv_action;
+static once_flag segv_handler_installed;
+
+/**
+ *  The first touch of a reserved page of a window allocates the page, and
+ *  the access is retried when the handler returns. An access to any other
+ *  page of a window is reported like a missing page in the page table, by
+ *  throwing from the handler. The accesses are in this file, compiled with
+ *  -fnon-call-exceptions so that the exception can unwind from the faulting
+ *  instruction, and SA_NODEFER keeps SIGSEGV unblocked after leaving the
+ *  handler this way.
+ */
+void MemorySystem::SIGSEGV_handler(int signum, siginfo_t *info, void *context)
+{
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    for (auto &window: flat_windows) {
+        MemorySystem *mem_sys = window.load(memory_order_relaxed);
+        uintptr_t base = mem_sys ? (uintptr_t)mem_sys->flat_base : 0;
+        if (base && addr - base < FLAT_SIZE) {
+            uintptr_t offset = addr - base;
+            uintptr_t va = offset < FLAT_HALF ? offset : offset - FLAT_SIZE + STACK_TOP;
+            if (!mem_sys->is_reserved(va) || mem_sys->lookup_pte(va))
+                throw_error("invalid address: %lx", va);
+            mem_sys->page_alloc(va);
+            return;
+        }
+    }
+    // not an access of the guest, fault again with the default action
+    sigaction(SIGSEGV, &default_segv_action, NULL);
+}
+
+void MemorySystem::install_SIGSEGV_handler()
+{
+    struct sigaction action = {};
+    action.sa_sigaction = SIGSEGV_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &default_segv_action);
+}
+
+MemorySystem::MemorySystem(const YAML::Node& cache_list, int memory_cycles, const string& backend,
+    bool non_blocking, const YAML::Node& dram_config)
+    : page_table(PAGE_TABLE_BUCKETS, std::hash<uintptr_t>(), std::equal_to<uintptr_t>(),
+        PageTable::allocator_type(&page_pool)),
+    non_blocking(non_blocking), context(), trace_writer(nullptr), flat_base(nullptr), code_page_num(0)
 {
+    flush_tlb();
+    if (backend != "flat" && backend != "page_table")
+        throw ConfigError("no memory backend named " + backend);
+
     map<string, Storage*> storage_map;
-    inst_entry = data_entry = memory = new Memory(memory_cycles);
+    dram = dram_config ? new Dram(dram_config) : nullptr;
+    if (dram)
+        dram->set_context(&context);
+    inst_entry = data_entry = memory = dram ? (Storage*)dram : new Memory(memory_cycles);
     storage_map["memory"] = memory;
     min_line_size = PGSIZE;
     for (auto &conf: cache_list) {
-        auto st = new Cache(conf);
+        auto st = new Cache(conf, non_blocking);
         cache.push_back(st);
         storage_map[st->get_name()] = st;
         min_line_size = min(min_line_size, st->get_line_size());
@@ -28,38 +90,118 @@ MemorySystem::MemorySystem(const YAML::Node& cache_list, int memory_cycles)
     for (auto &conf: cache_list) {
         auto st = dynamic_cast<Cache*>(storage_map[conf["name"].as<string>()]);
         st->set_next(storage_map[conf["cache_for"].as<string>()]);
+        st->set_context(&context);
+    }
+    fixed_caches = fixed.inst.bind(inst_entry) && fixed.data.bind(data_entry);
+
+    // reserved after the storage, whose configuration may be rejected
+    if (backend == "flat") {
+        void *base = mmap(NULL, FLAT_SIZE, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            free_storage();
+            throw_error("cannot reserve the flat memory: %s", strerror(errno));
+        }
+        // set before the window is visible to the handler
+        flat_base = (uint8_t*)base;
+        auto window = find_if(begin(flat_windows), end(flat_windows), [this](atomic<MemorySystem*>& w) {
+            MemorySystem *empty = nullptr;
+            return w.compare_exchange_strong(empty, this);
+        });
+        if (window == end(flat_windows)) {
+            flat_base = nullptr;
+            munmap(base, FLAT_SIZE);
+            free_storage();
+            throw_error("too many memory systems with the flat backend");
+        }
+        call_once(segv_handler_installed, install_SIGSEGV_handler);
     }
 }
 
 MemorySystem::~MemorySystem()
+{
+    free_storage();
+    for (const auto &mapping: mappings)
+        munmap(mapping.first, mapping.second);
+    if (flat_base) {
+        for (auto &window: flat_windows)
+            if (window.load() == this)
+                window.store(nullptr);
+        munmap(flat_base, FLAT_SIZE);
+    }
+}
+
+// the caches and the memory, also when the constructor gives up
+void MemorySystem::free_storage()
 {
     delete memory;
     for (auto c: cache)
         delete c;
-    for (const auto &pr: page_table)
-        operator delete((void*)pr.second, align_val_t(PGSIZE));
+    cache.clear();
+    memory = nullptr;
+}
+
+void MemorySystem::free_pages()
+{
+    if (flat_base) {
+        // map the window afresh, dropping all its pages at once
+        if (!page_table.empty() && mmap(flat_base, FLAT_SIZE, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+            throw_error("cannot reset the flat memory: %s", strerror(errno));
+    } else {
+        arena.clear();
+    }
+    page_table.clear();
+    regions.clear();
+    code_page_num = 0;
+    for (const auto &mapping: mappings)
+        munmap(mapping.first, mapping.second);
+    mappings.clear();
+    flush_tlb();
+}
+
+void MemorySystem::flush_tlb()
+{
+    for (int i = 0; i < HOST_TLB_SIZE; i++)
+        inst_tlb[i].vpn = data_tlb[i].vpn = -1;
 }
 
 void MemorySystem::reset()
 {
     heap_pointer = HEAP_START;
 
-    for (const auto &pr: page_table)
-        operator delete((void*)pr.second, align_val_t(PGSIZE));
-    page_table.clear();
+    free_pages();
+
+    for (auto observer: code_observers)
+        observer->invalidate_all_code();
 
     for (auto c: cache)
         c->invalidate();
+    if (dram)
+        dram->reset();
 
     total_memory_access_cycles = 0;
     memory_access_num = 0;
+    context = {0, 0};
 }
 
 pte_t MemorySystem::page_alloc(uintptr_t va)
 {
-    auto ptr = operator new(PGSIZE, align_val_t(PGSIZE));
-    memset(ptr, 0, PGSIZE);
+    void *ptr;
+    if (flat_base) {
+        // the pages of a fresh window read as zero once accessible
+        ptr = (void*)flat_translate(PGADDR(va));
+        if (page_table.count(PGADDR(va)))
+            memset(ptr, 0, PGSIZE);
+        else if (mprotect(ptr, PGSIZE, PROT_READ | PROT_WRITE) < 0)
+            throw_error("cannot allocate page: %s", strerror(errno));
+    } else {
+        ptr = arena.alloc(PGSIZE);
+    }
     page_table[PGADDR(va)] = (pte_t)ptr;
+    // the page may replace one the TLBs point to
+    unsigned index = (va >> 12) & (HOST_TLB_SIZE - 1);
+    inst_tlb[index].vpn = data_tlb[index].vpn = -1;
     return (pte_t)ptr;
 }
 
@@ -87,91 +229,238 @@ void MemorySystem::write_str(uintptr_t va, const char *str)
     }
 }
 
-uintptr_t MemorySystem::translate(reg_t ptr)
+void MemorySystem::add_code_observer(CodeObserver *observer)
+{
+    code_observers.push_back(observer);
+}
+
+void MemorySystem::mark_code_page(uintptr_t va)
+{
+    auto& pte = get_pte(va);
+    if (!(pte & PTE_CODE))
+        code_page_num++;
+    pte |= PTE_CODE;
+}
+
+pte_t MemorySystem::lookup_pte(uintptr_t va)
+{
+    auto pte_p = page_table.find(PGADDR(va));
+    return pte_p == page_table.end() ? 0 : pte_p->second;
+}
+
+pte_t& MemorySystem::get_pte(reg_t ptr)
 {
     auto pte_p = page_table.find(PGADDR(ptr));
-    if (pte_p == page_table.end())
+    if (pte_p != page_table.end())
+        return pte_p->second;
+    if (!is_reserved(ptr))
         throw_error("invalid address: %lx", ptr);
-    return PTE_ADDR(pte_p->second) | PGOFF(ptr);
+    // the first touch of a reserved page
+    page_alloc(ptr);
+    return page_table[PGADDR(ptr)];
 }
 
-int MemorySystem::read_inst(reg_t ptr, uint32_t& st)
+bool MemorySystem::is_reserved(uintptr_t va) const
+{
+    if (PGADDR(va) >= HEAP_START && PGADDR(va) < heap_pointer)
+        return true;
+    for (const auto &region: regions)
+        if (va >= region.first && va < region.second)
+            return true;
+    return false;
+}
+
+void MemorySystem::reserve(uintptr_t va, size_t size)
+{
+    uintptr_t begin = PGADDR(va), end = round_up(va + size, PGSIZE);
+    // the range must lie in one half of the window
+    if (flat_base && begin != end && (!in_flat_window(begin) || !in_flat_window(end - 1) ||
+            (begin < FLAT_HALF) != (end - 1 < FLAT_HALF)))
+        throw_error("invalid address: %lx", begin < FLAT_HALF ? end - 1 : begin);
+    regions.push_back({begin, end});
+}
+
+uintptr_t MemorySystem::translate(reg_t ptr)
+{
+    return PTE_ADDR(get_pte(ptr)) | PGOFF(ptr);
+}
+
+void MemorySystem::notify_code_write(reg_t ptr)
+{
+    auto& pte = get_pte(ptr);
+    if (!(pte & PTE_CODE))
+        return;
+    pte &= ~(pte_t)PTE_CODE;
+    code_page_num--;
+    for (auto observer: code_observers)
+        observer->invalidate_code_page(PGADDR(ptr));
+}
+
+inst_t MemorySystem::fetch_inst(reg_t ptr)
 {
     if ((ptr & (PGSIZE - 1)) == 0xFFE) {
-        st = *(uint16_t*)translate(ptr);
-        st |= (uint32_t)*(uint16_t*)translate(ptr + 2) << 16;
+        inst_t st = *(uint16_t*)translate(ptr, inst_tlb);
+        st |= (uint32_t)*(uint16_t*)translate(ptr + 2, inst_tlb) << 16;
+        return st;
+    }
+    return *(uint32_t*)translate(ptr, inst_tlb);
+}
+
+reg_t MemorySystem::load(reg_t ptr, int bytes)
+{
+    if ((ptr & (PGSIZE - 1)) > PGSIZE - bytes) {
+        reg_t reg = 0;
+        for (int i = 0; i < bytes; i++)
+            reg |= (reg_t)*(uint8_t*)translate(ptr + i, data_tlb) << (i * 8);
+        return reg;
+    }
+    auto pa = translate(ptr, data_tlb);
+    switch (bytes) {
+    case 1: return *(uint8_t*)pa;
+    case 2: return *(uint16_t*)pa;
+    case 4: return *(uint32_t*)pa;
+    default: return *(uint64_t*)pa;
+    }
+}
+
+void MemorySystem::store(reg_t ptr, reg_t reg, int bytes)
+{
+    if ((ptr & (PGSIZE - 1)) > PGSIZE - bytes) {
+        notify_code_write(ptr);
+        notify_code_write(ptr + bytes - 1);
+        for (int i = 0; i < bytes; i++)
+            *(uint8_t*)translate(ptr + i, data_tlb) = (reg >> (i * 8)) & 0xFF;
+        return;
+    }
+    uintptr_t pa;
+    if (flat_base) {
+        pa = flat_translate(ptr);
+        if (code_page_num && (get_pte(ptr, data_tlb) & PTE_CODE))
+            notify_code_write(ptr);
     } else {
-        st = *(uint32_t*)translate(ptr);
+        auto& pte = get_pte(ptr, data_tlb);
+        if (pte & PTE_CODE)
+            notify_code_write(ptr);
+        pa = PTE_ADDR(pte) | PGOFF(ptr);
     }
+    switch (bytes) {
+    case 1: *(uint8_t*)pa = (uint8_t)reg; break;
+    case 2: *(uint16_t*)pa = (uint16_t)reg; break;
+    case 4: *(uint32_t*)pa = (uint32_t)reg; break;
+    case 8: *(uint64_t*)pa = (uint64_t)reg; break;
+    }
+}
+
+int MemorySystem::read_inst(reg_t ptr, uint32_t& st)
+{
+    st = fetch_inst(ptr);
+    if (trace_writer)
+        trace_writer->record(TRACE_INST, ptr, 4, ptr);
+    context.pc = ptr;
 
     // get cycles num
-    int cycles = inst_entry->read(translate(ptr));
-    if ((ptr & (min_line_size - 1)) > min_line_size - 4)
-        cycles += inst_entry->read(translate(ptr + 2));
+    int cycles;
+    if (non_blocking) {
+        // the fetch still waits for its data
+        uint64_t now = context.cycle;
+        uint64_t done = inst_entry->read_at(ptr, now);
+        if ((ptr & (min_line_size - 1)) > min_line_size - 4)
+            done = max(done, inst_entry->read_at(ptr + 2, now));
+        cycles = done - context.cycle;
+    } else {
+        cycles = inst_access(ptr);
+        if ((ptr & (min_line_size - 1)) > min_line_size - 4)
+            cycles += inst_access(ptr + 2);
+    }
     total_memory_access_cycles += cycles;
     memory_access_num++;
     return cycles;
 }
 
-int MemorySystem::read_data(reg_t ptr, reg_t& reg, int bytes)
+int MemorySystem::read_data(reg_t ptr, reg_t& reg, int bytes, reg_t pc)
 {
-    if ((ptr & (PGSIZE - 1)) > PGSIZE - bytes) {
-        reg = 0;
-        for (int i = 0; i < bytes; i++)
-            reg |= (reg_t)*(uint8_t*)translate(ptr + i) << (i * 8);
-    } else {
-        auto pa = translate(ptr);
-        switch (bytes) {
-        case 1: reg = *(uint8_t*)pa; break;
-        case 2: reg = *(uint16_t*)pa; break;
-        case 4: reg = *(uint32_t*)pa; break;
-        case 8: reg = *(uint64_t*)pa; break;
-        }
-    }
+    reg = load(ptr, bytes);
+    if (trace_writer)
+        trace_writer->record(TRACE_READ, ptr, bytes, pc);
+    context.pc = pc;
 
     // get cycles num
-    int cycles = data_entry->read(translate(ptr));
+    int cycles = data_access<false>(ptr);
     if ((ptr & (min_line_size - 1)) > min_line_size - bytes)
-        cycles += data_entry->read(translate(ptr + bytes - 1));
+        cycles += data_access<false>(ptr + bytes - 1);
     total_memory_access_cycles += cycles;
     memory_access_num++;
     return cycles;
 }
 
-int MemorySystem::write_data(reg_t ptr, reg_t reg, int bytes)
+int MemorySystem::write_data(reg_t ptr, reg_t reg, int bytes, reg_t pc)
 {
-    if ((ptr & (PGSIZE - 1)) > PGSIZE - bytes) {
-        for (int i = 0; i < bytes; i++)
-            *(uint8_t*)translate(ptr + i) = (reg >> (i * 8)) & 0xFF;
-    } else {
-        auto pa = translate(ptr);
-        switch (bytes) {
-        case 1: *(uint8_t*)pa = (uint8_t)reg; break;
-        case 2: *(uint16_t*)pa = (uint16_t)reg; break;
-        case 4: *(uint32_t*)pa = (uint32_t)reg; break;
-        case 8: *(uint64_t*)pa = (uint64_t)reg; break;
-        }
-    }
+    store(ptr, reg, bytes);
+    if (trace_writer)
+        trace_writer->record(TRACE_WRITE, ptr, bytes, pc);
+    context.pc = pc;
 
     // get cycles num
-    int cycles = data_entry->write(translate(ptr));
+    int cycles = data_access<true>(ptr);
     if ((ptr & (min_line_size - 1)) > min_line_size - bytes)
-        cycles += data_entry->write(translate(ptr + bytes - 1));
+        cycles += data_access<true>(ptr + bytes - 1);
     total_memory_access_cycles += cycles;
     memory_access_num++;
     return cycles;
 }
 
+uint64_t MemorySystem::issue_read(reg_t ptr, reg_t& reg, int bytes, reg_t pc, uint64_t& accepted)
+{
+    reg = load(ptr, bytes);
+    if (trace_writer)
+        trace_writer->record(TRACE_READ, ptr, bytes, pc);
+    context.pc = pc;
+
+    accepted = context.cycle;
+    uint64_t done = data_entry->read_at(ptr, accepted);
+    if ((ptr & (min_line_size - 1)) > min_line_size - bytes)
+        done = max(done, data_entry->read_at(ptr + bytes - 1, accepted));
+    total_memory_access_cycles += done - context.cycle;
+    memory_access_num++;
+    return done;
+}
+
+uint64_t MemorySystem::issue_write(reg_t ptr, reg_t reg, int bytes, reg_t pc, uint64_t& accepted)
+{
+    store(ptr, reg, bytes);
+    if (trace_writer)
+        trace_writer->record(TRACE_WRITE, ptr, bytes, pc);
+    context.pc = pc;
+
+    accepted = context.cycle;
+    uint64_t done = data_entry->write_at(ptr, accepted);
+    if ((ptr & (min_line_size - 1)) > min_line_size - bytes)
+        done = max(done, data_entry->write_at(ptr + bytes - 1, accepted));
+    total_memory_access_cycles += done - context.cycle;
+    memory_access_num++;
+    return done;
+}
+
+void MemorySystem::reset_timing()
+{
+    for (auto c: cache)
+        c->reset_timing();
+    if (dram)
+        dram->reset_timing();
+}
+
+void MemorySystem::set_trace_writer(TraceWriter *writer)
+{
+    trace_writer = writer;
+}
+
+// the pages below the heap pointer are allocated when first touched
 uintptr_t MemorySystem::sbrk(size_t size)
 {
     uintptr_t old_heap_pointer = heap_pointer;
-    uintptr_t end = heap_pointer + size;
-    while (heap_pointer < end) {
-        if (page_table.find(PGADDR(heap_pointer)) == page_table.end())
-            page_alloc(heap_pointer);
-        heap_pointer = PGADDR(heap_pointer) + PGSIZE;
-    }
-    heap_pointer = end;
+    if (flat_base && heap_pointer + size > FLAT_HALF)
+        throw_error("invalid address: %lx", heap_pointer + size - 1);
+    heap_pointer += size;
     return old_heap_pointer;
 }
 
@@ -216,44 +505,213 @@ void MemorySystem::output_memory(uintptr_t va, char fm, char sz, size_t length)
     }
 }
 
-void MemorySystem::print_info()
+vector<string> MemorySystem::get_cache_names() const
+{
+    vector<string> names;
+    for (auto c: cache)
+        names.push_back(c->get_name());
+    return names;
+}
+
+MemoryStats MemorySystem::get_stats() const
+{
+    MemoryStats stats;
+    stats.total_memory_access_cycles = total_memory_access_cycles;
+    stats.memory_access_num = memory_access_num;
+    stats.hit_num.resize(cache.size());
+    stats.miss_num.resize(cache.size());
+    for (size_t i = 0; i < cache.size(); i++)
+        cache[i]->get_stats(stats.hit_num[i], stats.miss_num[i]);
+    stats.dram = dram ? dram->get_stats() : DramStats();
+    return stats;
+}
+
+void MemorySystem::set_stats(const MemoryStats& stats)
+{
+    total_memory_access_cycles = stats.total_memory_access_cycles;
+    memory_access_num = stats.memory_access_num;
+    for (size_t i = 0; i < cache.size(); i++)
+        cache[i]->set_stats(stats.hit_num[i], stats.miss_num[i]);
+    if (dram)
+        dram->set_stats(stats.dram);
+}
+
+void MemorySystem::print_info(uint64_t cycles)
 {
     size_t heap_size = heap_pointer - HEAP_START;
     printf("heap_size: 0x%lx(%lu) bytes\n", heap_size, heap_size);
     printf("AMAT: %.2f cycles\n", (double)total_memory_access_cycles / memory_access_num);
     for (auto c: cache)
         c->print_info();
+    if (dram)
+        dram->print_info(cycles);
 }
 
-void MemorySystem::run_trace(const string& trace_file)
+/**
+ *  Map the pages at `va` from the file, one page after another from
+ *  `offset`, copy-on-write so that the file is never written.
+ */
+void MemorySystem::map_pages(int fd, size_t offset, const vector<uintptr_t>& va)
+{
+    size_t page_num = va.size(), length = page_num * PGSIZE;
+    if (flat_base) {
+        // map each run of adjacent pages to its place in the window
+        for (uint64_t i = 0, j; i < page_num; i = j) {
+            for (j = i + 1; j < page_num && va[j] == va[j - 1] + PGSIZE; j++)
+                ;
+            void *addr = (void*)flat_translate(va[i]);
+            if (!in_flat_window(va[j - 1]) || mmap(addr, (j - i) * PGSIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, fd, offset + i * PGSIZE) == MAP_FAILED)
+                throw_error("cannot map page %lx", va[i]);
+            for (uint64_t k = i; k < j; k++)
+                page_table[va[k]] = (uintptr_t)addr + (k - i) * PGSIZE;
+        }
+    } else if (length) {
+        void *data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+        if (data == MAP_FAILED)
+            throw_error("cannot map pages: %s", strerror(errno));
+        mappings.push_back({data, length});
+        for (uint64_t i = 0; i < page_num; i++)
+            page_table[va[i]] = (uintptr_t)data + i * PGSIZE;
+    }
+}
+
+MemoryImage::~MemoryImage()
+{
+    close(fd);
+}
+
+shared_ptr<MemoryImage> MemorySystem::capture_image() const
+{
+    auto image = make_shared<MemoryImage>();
+    image->fd = memfd_create("memory_image", MFD_CLOEXEC);
+    if (image->fd < 0)
+        throw_error("cannot create memory image: %s", strerror(errno));
+    map<uintptr_t, pte_t> pages(page_table.begin(), page_table.end());
+    size_t offset = 0;
+    for (const auto &pr: pages) {
+        if (pwrite(image->fd, (void*)PTE_ADDR(pr.second), PGSIZE, offset) != (ssize_t)PGSIZE)
+            throw_error("cannot write memory image: %s", strerror(errno));
+        image->va.push_back(pr.first);
+        offset += PGSIZE;
+    }
+    return image;
+}
+
+void MemorySystem::map_image(const MemoryImage& image)
+{
+    map_pages(image.fd, 0, image.va);
+}
+
+/**
+ *  Checkpoint layout: the heap pointer, the access counters, the reserved
+ *  regions, the number of pages allocated and their addresses, the contents of the pages starting at the next
+ *  page-aligned offset of the file so that they can be mapped directly, and
+ *  then the caches.
+ */
+void MemorySystem::save(FILE *file) const
 {
-    ifstream f_trace(trace_file);
-    if (!f_trace) {
-        cerr << "error: cannot open " << trace_file << endl;
-        exit(EXIT_FAILURE);
+    checkpoint_write(file, &heap_pointer, sizeof(heap_pointer));
+    checkpoint_write(file, &total_memory_access_cycles, sizeof(total_memory_access_cycles));
+    checkpoint_write(file, &memory_access_num, sizeof(memory_access_num));
+
+    uint64_t region_num = regions.size();
+    checkpoint_write(file, &region_num, sizeof(region_num));
+    checkpoint_write(file, regions.data(), sizeof(regions[0]) * region_num);
+
+    // in address order, so that adjacent pages stay adjacent in the file
+    map<uintptr_t, pte_t> pages(page_table.begin(), page_table.end());
+    uint64_t page_num = pages.size();
+    checkpoint_write(file, &page_num, sizeof(page_num));
+    for (const auto &pr: pages)
+        checkpoint_write(file, &pr.first, sizeof(pr.first));
+
+    static const char zeros[PGSIZE] = {};
+    checkpoint_write(file, zeros, round_up(ftell(file), PGSIZE) - ftell(file));
+    for (const auto &pr: pages)
+        checkpoint_write(file, (void*)PTE_ADDR(pr.second), PGSIZE);
+
+    uint64_t cache_num = cache.size();
+    checkpoint_write(file, &cache_num, sizeof(cache_num));
+    for (auto c: cache)
+        c->save(file);
+}
+
+void MemorySystem::restore(FILE *file)
+{
+    checkpoint_read(file, &heap_pointer, sizeof(heap_pointer));
+    checkpoint_read(file, &total_memory_access_cycles, sizeof(total_memory_access_cycles));
+    checkpoint_read(file, &memory_access_num, sizeof(memory_access_num));
+
+    uint64_t region_num;
+    checkpoint_read(file, &region_num, sizeof(region_num));
+    regions.resize(region_num);
+    checkpoint_read(file, regions.data(), sizeof(regions[0]) * region_num);
+
+    uint64_t page_num;
+    checkpoint_read(file, &page_num, sizeof(page_num));
+    vector<uintptr_t> va(page_num);
+    checkpoint_read(file, va.data(), sizeof(uintptr_t) * page_num);
+
+    size_t offset = round_up(ftell(file), PGSIZE), length = page_num * PGSIZE;
+    struct stat st;
+    if (fstat(fileno(file), &st) < 0 || (size_t)st.st_size < offset + length)
+        throw_error("cannot read checkpoint, the file is truncated");
+    map_pages(fileno(file), offset, va);
+    fseek(file, offset + length, SEEK_SET);
+
+    uint64_t cache_num;
+    checkpoint_read(file, &cache_num, sizeof(cache_num));
+    bool cold = cache_num != cache.size();
+    for (uint64_t i = 0; i < cache_num; i++) {
+        if (i < cache.size())
+            cold |= !cache[i]->restore(file);
+        else
+            Cache::skip(file);
+    }
+    if (cold) {
+        // the statistics must not mix a partly restored hierarchy
+        for (auto c: cache)
+            c->invalidate();
+        cerr << "warning: the caches differ from the checkpoint, starting them cold" << endl;
     }
+}
 
+/**
+ *  Replay a trace through the caches. As in read_inst, read_data and
+ *  write_data, an access crossing the smallest cache line also accesses
+ *  the next line. The addresses are guest addresses, as the caches see
+ *  them when running an ELF file.
+ */
+void MemorySystem::run_trace(const string& trace_file)
+{
     reset();
-    string action, addr_str;
-    while (f_trace >> action >> addr_str) {
-        uintptr_t addr;
-        try {
-            addr = stoull(addr_str, nullptr, 0);
-        } catch (const invalid_argument&) {
-            cerr << "invalid address: " << addr_str << endl;
-            exit(EXIT_FAILURE);
-        }
-        if (action == "r") {
-            total_memory_access_cycles += data_entry->read(addr);
-            memory_access_num++;
-        } else if (action == "w") {
-            total_memory_access_cycles += data_entry->write(addr);
-            memory_access_num++;
-        } else {
-            cerr << "invalid action: " << action << endl;
-            exit(EXIT_FAILURE);
+    TraceReader reader(trace_file);
+    TraceKind kind;
+    uint64_t addr;
+    int bytes;
+    // the cycles of the accesses so far stand for the time
+    while (reader.next(kind, addr, bytes, context.pc)) {
+        context.cycle = total_memory_access_cycles;
+        bool crossing = (addr & (min_line_size - 1)) > min_line_size - bytes;
+        switch (kind) {
+        case TRACE_INST:
+            total_memory_access_cycles += inst_access(addr);
+            if (crossing)
+                total_memory_access_cycles += inst_access(addr + 2);
+            break;
+        case TRACE_READ:
+            total_memory_access_cycles += data_access<false>(addr);
+            if (crossing)
+                total_memory_access_cycles += data_access<false>(addr + bytes - 1);
+            break;
+        default:
+            total_memory_access_cycles += data_access<true>(addr);
+            if (crossing)
+                total_memory_access_cycles += data_access<true>(addr + bytes - 1);
         }
+        memory_access_num++;
     }
 
-    print_info();
+    print_info(total_memory_access_cycles);
 }
@@ -2,12 +2,17 @@
 #define MEMORY_SYSTEM_HPP
 
 #include <cstdio>
+#include <csignal>
 #include <unordered_map>
 #include <vector>
+#include <memory>
 #include <yaml-cpp/yaml.h>
 #include "types.hpp"
 #include "elf.hpp"
 #include "cache.hpp"
+#include "dram.hpp"
+#include "trace.hpp"
+#include "page_arena.hpp"
 
 typedef uint64_t pte_t;
 
@@ -17,43 +22,236 @@ typedef uint64_t pte_t;
 #define PTE_ADDR(pte)   PGADDR(pte)
 #define PGOFF(la)	    (((uintptr_t) (la)) & 0xFFF)
 
+// Page table entry flags, kept in the low bits of the page-aligned pte
+#define PTE_CODE    0x1  // the page holds instructions cached by a CodeObserver
+
 #define E_NO_MEM 1
 
+#define HOST_TLB_SIZE   256
+#define PAGE_TABLE_BUCKETS  4096  // pages of a program before the first rehash
+
 #define HEAP_START 0x800000000UL
 #define STACK_TOP  0x1000000000000UL
 
+// The flat backend reserves a host window of FLAT_SIZE bytes for the guest:
+// the lower half mirrors [0, FLAT_HALF), holding the program and the heap,
+// and the upper half the FLAT_HALF bytes below STACK_TOP, so a guest address
+// translates to the base plus its low bits
+#define FLAT_HALF   (1ULL << 36)
+#define FLAT_SIZE   (2 * FLAT_HALF)
+
+// Notified when the guest writes to a page marked as code, so that
+// anything derived from the instructions there can be dropped
+struct CodeObserver
+{
+    virtual void invalidate_code_page(uintptr_t va) = 0;
+    virtual void invalidate_all_code() = 0;
+    virtual ~CodeObserver() = default;
+};
+
+// pages captured from a memory system into a memfd, to be mapped
+// copy-on-write into any number of memory systems
+struct MemoryImage
+{
+    int fd;
+    std::vector<uintptr_t> va;  // of the pages, one after another in the file
+    ~MemoryImage();
+};
+
+// counters shown by print_info
+struct MemoryStats
+{
+    size_t total_memory_access_cycles;
+    size_t memory_access_num;
+    std::vector<uint64_t> hit_num, miss_num;  // of each cache
+    DramStats dram;  // zero without a DRAM
+};
+
 class MemorySystem
 {
 private:
-    std::unordered_map<uintptr_t, pte_t> page_table;
+    typedef std::unordered_map<uintptr_t, pte_t, std::hash<uintptr_t>, std::equal_to<uintptr_t>,
+        PoolAllocator<std::pair<const uintptr_t, pte_t>>> PageTable;
+    NodePool page_pool;  // the nodes of `page_table`, kept across runs
+    PageTable page_table;
     uintptr_t heap_pointer;
+    PageArena arena;  // the pages not mapped from a checkpoint or the window
+
+    // ranges [begin, end) whose pages read as zero and are only allocated
+    // when first touched, besides the heap below `heap_pointer`
+    std::vector<std::pair<uintptr_t, uintptr_t>> regions;
 
     std::vector<Cache*> cache;
     unsigned min_line_size;  // must be an power of 2, and >= 8
     Storage *inst_entry, *data_entry;
-    Memory *memory;
+    Storage *memory;  // `dram` if configured, a Memory otherwise
+    Dram *dram;
+
+    // the caches of default_config.yml with their geometry compiled in,
+    // used instead of the entries when the configuration has them
+    DefaultHierarchy fixed;
+    bool fixed_caches;
+
+    // the pipeline accesses the caches with read_at and write_at, see
+    // issue_read and issue_write
+    bool non_blocking;
 
     size_t total_memory_access_cycles;
     size_t memory_access_num;
+    AccessContext context;  // seen by the prefetchers of the caches
+
+    TraceWriter *trace_writer;  // records the accesses if not null
+
+    std::vector<CodeObserver*> code_observers;
+
+    // regions mapped from checkpoints, holding their pages
+    std::vector<std::pair<void*, size_t>> mappings;
 
+    // the window of the flat backend, null when the pages are allocated one
+    // by one. The page table still records the pages and their flags: a page
+    // of the window is inaccessible until first touched, when the SIGSEGV
+    // handler allocates it.
+    uint8_t *flat_base;
+    size_t code_page_num;  // pages marked PTE_CODE
+
+    // direct-mapped caches of the page table in front of the hash map, one
+    // for instruction fetches and one for data. An entry points to the pte
+    // in the map, which stays valid until the pages are freed, so the flags
+    // of the pte are seen as they change.
+    struct TlbEntry
+    {
+        uint64_t vpn;
+        pte_t *pte;
+    };
+    TlbEntry inst_tlb[HOST_TLB_SIZE];
+    TlbEntry data_tlb[HOST_TLB_SIZE];
+
+    pte_t& get_pte(reg_t ptr);
+    bool is_reserved(uintptr_t va) const;
+    void free_storage();
+    void free_pages();
+    void map_pages(int fd, size_t offset, const std::vector<uintptr_t>& va);
+    void flush_tlb();
     uintptr_t translate(reg_t ptr);
+    void notify_code_write(reg_t ptr);
+    static void install_SIGSEGV_handler();
+    static void SIGSEGV_handler(int signum, siginfo_t *info, void *context);
+
+    inline pte_t& get_pte(reg_t ptr, TlbEntry *tlb)
+    {
+        uint64_t vpn = ptr >> 12;
+        auto& entry = tlb[vpn & (HOST_TLB_SIZE - 1)];
+        if (entry.vpn != vpn) {
+            entry.pte = &get_pte(ptr);
+            entry.vpn = vpn;
+        }
+        return *entry.pte;
+    }
+
+    // the caches are indexed by guest addresses, so that the statistics do
+    // not depend on where the pages happen to be in the host, and a trace
+    // replays the same accesses
+    inline int inst_access(uintptr_t addr)
+    {
+        return fixed_caches ? fixed.inst.read(addr) : inst_entry->read(addr);
+    }
+
+    template <bool is_write>
+    inline int data_access(uintptr_t addr)
+    {
+        if (fixed_caches)
+            return is_write ? fixed.data.write(addr) : fixed.data.read(addr);
+        return is_write ? data_entry->write(addr) : data_entry->read(addr);
+    }
+
+    static inline bool in_flat_window(reg_t ptr)
+    {
+        return ptr < FLAT_HALF || ptr - (STACK_TOP - FLAT_HALF) < FLAT_HALF;
+    }
+
+    // pages of the window not allocated are inaccessible, and the SIGSEGV
+    // of an access to them allocates the page if it is reserved, or is
+    // turned into the error of a missing page
+    inline uintptr_t flat_translate(reg_t ptr)
+    {
+        if (!in_flat_window(ptr))
+            throw_error("invalid address: %lx", ptr);
+        return (uintptr_t)flat_base + (ptr & (FLAT_SIZE - 1));
+    }
+
+    inline uintptr_t translate(reg_t ptr, TlbEntry *tlb)
+    {
+        if (flat_base)
+            return flat_translate(ptr);
+        return PTE_ADDR(get_pte(ptr, tlb)) | PGOFF(ptr);
+    }
 
 public:
-    MemorySystem(const YAML::Node& cache_list, int memory_cycles);
+    // `backend` is "page_table" or "flat", the memory is a Dram if
+    // `dram_config` is given, taking `memory_cycles` for every access otherwise
+    MemorySystem(const YAML::Node& cache_list, int memory_cycles,
+        const std::string& backend = "page_table", bool non_blocking = false,
+        const YAML::Node& dram_config = YAML::Node());
     ~MemorySystem();
     void reset();
     pte_t page_alloc(uintptr_t va);
+    void reserve(uintptr_t va, size_t size);  // pages allocated when touched
     void load_segment(FILE *file, const Elf64_Phdr& phdr);
     void write_str(uintptr_t va, const char *str);
+    void add_code_observer(CodeObserver *observer);
+    void mark_code_page(uintptr_t va);
+    pte_t lookup_pte(uintptr_t va);  // 0 if the page is not mapped
 
-    // return the number of cycles required
+    // functional accesses, bypassing the caches
+    inst_t fetch_inst(reg_t ptr);
+    reg_t load(reg_t ptr, int bytes);
+    void store(reg_t ptr, reg_t reg, int bytes);
+
+    // the cycle of the pipeline, when the data of prefetches arrive and the
+    // accesses of non-blocking mode start. The accesses in flight are
+    // dropped if it goes back, as when the counters are restored.
+    inline void set_cycle(uint64_t cycle)
+    {
+        if (cycle < context.cycle)
+            reset_timing();
+        context.cycle = cycle;
+    }
+    void reset_timing();
+    // functional warming, whose accesses leave the counters of the DRAM alone
+    inline void set_warming(bool warming)
+    {
+        context.warming = warming;
+    }
+
+    // return the number of cycles required, `pc` is for the trace and the
+    // prefetchers
     int read_inst(reg_t ptr, inst_t& st);
-    int read_data(reg_t ptr, reg_t& reg, int bytes);
-    int write_data(reg_t ptr, reg_t reg, int bytes);
+    int read_data(reg_t ptr, reg_t& reg, int bytes, reg_t pc = 0);
+    int write_data(reg_t ptr, reg_t reg, int bytes, reg_t pc = 0);
+    // non-blocking mode: start the access in the current cycle, set
+    // `accepted` to the cycle the data cache takes it, and return the cycle
+    // its data is there
+    uint64_t issue_read(reg_t ptr, reg_t& reg, int bytes, reg_t pc, uint64_t& accepted);
+    uint64_t issue_write(reg_t ptr, reg_t reg, int bytes, reg_t pc, uint64_t& accepted);
+    void set_trace_writer(TraceWriter *writer);
     uintptr_t sbrk(size_t size);
 
     void output_memory(uintptr_t va, char fm, char sz, size_t length);
-    void print_info();
+    std::vector<std::string> get_cache_names() const;
+    MemoryStats get_stats() const;
+    void set_stats(const MemoryStats& stats);
+    void print_info(uint64_t cycles);  // the cycles elapsed, for the DRAM
+
+    // checkpoint of the pages, the heap and the caches, the pages are
+    // mapped copy-on-write from the file when restored
+    void save(FILE *file) const;
+    void restore(FILE *file);
+
+    // snapshot of the pages, such as the loaded program, and the mapping of
+    // a snapshot in place of loading it again; only the pages written later
+    // are copied
+    std::shared_ptr<MemoryImage> capture_image() const;
+    void map_image(const MemoryImage& image);
 
     void run_trace(const std::string& trace_file);
 };
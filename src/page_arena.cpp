@@ -0,0 +1,100 @@
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include "page_arena.hpp"
+using namespace std;
+
+PageArena::PageArena()
+    : current(0), next(nullptr), end(nullptr)
+{
+}
+
+PageArena::~PageArena()
+{
+    for (const auto &chunk: chunks)
+        munmap(chunk.base, ARENA_CHUNK_SIZE);
+}
+
+// move to the next chunk, mapping a new one aligned to the huge page size
+void PageArena::next_chunk()
+{
+    if (next)
+        current++;
+    if (current == chunks.size()) {
+        size_t length = 2 * ARENA_CHUNK_SIZE;
+        void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (addr == MAP_FAILED)
+            throw_error("cannot allocate pages: %s", strerror(errno));
+        uint8_t *base = round_up((uint8_t*)addr, ARENA_CHUNK_SIZE);
+        if (base != addr)
+            munmap(addr, base - (uint8_t*)addr);
+        munmap(base + ARENA_CHUNK_SIZE, (uint8_t*)addr + length - base - ARENA_CHUNK_SIZE);
+#ifdef MADV_HUGEPAGE
+        madvise(base, ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+        chunks.push_back({base, 0});
+    }
+    next = chunks[current].base;
+    end = next + ARENA_CHUNK_SIZE;
+}
+
+void* PageArena::alloc(size_t size)
+{
+    if ((size_t)(end - next) < size)
+        next_chunk();
+    Chunk& chunk = chunks[current];
+    uint8_t *ptr = next;
+    next += size;
+    size_t offset = ptr - chunk.base;
+    if (offset < chunk.used)
+        memset(ptr, 0, min(size, chunk.used - offset));
+    chunk.used = max(chunk.used, offset + size);
+    return ptr;
+}
+
+void PageArena::clear()
+{
+    current = 0;
+    next = end = nullptr;
+}
+
+NodePool::NodePool()
+    : chunks(nullptr), free_list(nullptr), next(nullptr), end(nullptr)
+{
+}
+
+NodePool::~NodePool()
+{
+    while (chunks) {
+        void *chunk = chunks;
+        chunks = *(void**)chunk;
+        ::operator delete(chunk);
+    }
+}
+
+void* NodePool::alloc()
+{
+    if (free_list) {
+        void *block = free_list;
+        free_list = *(void**)block;
+        return block;
+    }
+    if (next == end) {
+        // the first block of a chunk links to the previous chunk
+        uint8_t *chunk = (uint8_t*)::operator new(NODE_CHUNK_SIZE);
+        *(void**)chunk = chunks;
+        chunks = chunk;
+        next = chunk + NODE_BLOCK_SIZE;
+        end = chunk + NODE_CHUNK_SIZE;
+    }
+    void *block = next;
+    next += NODE_BLOCK_SIZE;
+    return block;
+}
+
+void NodePool::free(void *block)
+{
+    *(void**)block = free_list;
+    free_list = block;
+}
@@ -0,0 +1,103 @@
+#ifndef PAGE_ARENA_HPP
+#define PAGE_ARENA_HPP
+
+#include <new>
+#include <vector>
+#include "types.hpp"
+
+#define ARENA_CHUNK_SIZE    (2 << 20)  // a huge page
+#define NODE_CHUNK_SIZE     (64 << 10)
+#define NODE_BLOCK_SIZE     32
+
+/**
+ *  Bump allocator of guest pages in chunks of huge pages, so the pages of a
+ *  program are contiguous and need few host TLB entries. Chunks are mapped
+ *  from the kernel and zero at first. `clear` only rewinds the arena: the
+ *  chunks are kept for the next run, and a page handed out again is cleared
+ *  then.
+ */
+class PageArena
+{
+private:
+    struct Chunk
+    {
+        uint8_t *base;
+        size_t used;  // bytes ever handed out, which may be dirty
+    };
+    std::vector<Chunk> chunks;
+    size_t current;  // index of the chunk allocated from
+    uint8_t *next, *end;
+
+    void next_chunk();
+
+public:
+    PageArena();
+    ~PageArena();
+    // `size` is a multiple of the page size, at most ARENA_CHUNK_SIZE
+    void* alloc(size_t size);
+    void clear();
+};
+
+/**
+ *  Blocks of NODE_BLOCK_SIZE bytes for the nodes of a container, such as
+ *  the page table, which otherwise takes one heap allocation for every page
+ *  first touched. Blocks come from chunks linked through their first block,
+ *  and released ones are kept on a free list for the next run.
+ */
+class NodePool
+{
+private:
+    void *chunks;
+    void *free_list;
+    uint8_t *next, *end;
+
+public:
+    NodePool();
+    ~NodePool();
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+    void* alloc();
+    void free(void *block);
+};
+
+// allocator of a container taking its single nodes from a NodePool, and
+// arrays such as the buckets of a hash table from the heap
+template <class T>
+struct PoolAllocator
+{
+    typedef T value_type;
+    NodePool *pool;
+
+    PoolAllocator(NodePool *pool) : pool(pool) {}
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1 && sizeof(T) <= NODE_BLOCK_SIZE)
+            return (T*)pool->alloc();
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n == 1 && sizeof(T) <= NODE_BLOCK_SIZE)
+            pool->free(p);
+        else
+            ::operator delete(p);
+    }
+};
+
+template <class T, class U>
+inline bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return a.pool == b.pool;
+}
+
+template <class T, class U>
+inline bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b)
+{
+    return a.pool != b.pool;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include <string>
+#include "prefetcher.hpp"
+using namespace std;
+
+Prefetcher::Prefetcher(const YAML::Node& config, int line_bits)
+    : line_bits(line_bits)
+{
+    degree = config["degree"].as<int>(1);
+    distance = config["distance"].as<int>(1);
+    if (degree < 1 || degree > MAX_PREFETCH_DEGREE || distance < 1)
+        throw ConfigError("degree of a prefetcher must be in [1, " + to_string(MAX_PREFETCH_DEGREE) +
+            "] and its distance positive");
+}
+
+NextLinePrefetcher::NextLinePrefetcher(const YAML::Node& config, int line_bits)
+    : Prefetcher(config, line_bits)
+{
+}
+
+const char* NextLinePrefetcher::get_name() const
+{
+    return "next line";
+}
+
+int NextLinePrefetcher::predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines)
+{
+    if (trigger == ACCESS_HIT)
+        return 0;
+    uintptr_t line = addr >> line_bits;
+    for (int i = 0; i < degree; i++)
+        lines[i] = (line + distance + i) << line_bits;
+    return degree;
+}
+
+StridePrefetcher::StridePrefetcher(const YAML::Node& config, int line_bits)
+    : Prefetcher(config, line_bits)
+{
+    size_t table_size = config["table_size"].as<size_t>(256);
+    if (!table_size || (table_size & (table_size - 1)))
+        throw ConfigError("table_size of a stride prefetcher must be a power of 2");
+    table.resize(table_size);
+    reset();
+}
+
+const char* StridePrefetcher::get_name() const
+{
+    return "stride";
+}
+
+int StridePrefetcher::predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines)
+{
+    // instructions are at least 2-byte aligned
+    Entry& e = table[(pc >> 1) & (table.size() - 1)];
+    if (e.pc != pc) {
+        e = {pc, addr, 0, 0};
+        return 0;
+    }
+    int64_t stride = addr - e.last_addr;
+    e.last_addr = addr;
+    if (stride != e.stride) {
+        e.stride = stride;
+        e.confidence = 0;
+        return 0;
+    }
+    if (e.confidence < 3)
+        e.confidence++;
+    if (e.confidence < 2 || stride == 0)
+        return 0;
+
+    // strides shorter than a line predict the same line several times
+    int count = 0;
+    for (int i = 0; i < degree; i++) {
+        uintptr_t line = (addr + stride * (distance + i)) >> line_bits << line_bits;
+        if (count == 0 || lines[count - 1] != line)
+            lines[count++] = line;
+    }
+    return count;
+}
+
+void StridePrefetcher::reset()
+{
+    for (Entry& e: table)
+        e = {~(reg_t)0, 0, 0, 0};
+}
+
+StreamPrefetcher::StreamPrefetcher(const YAML::Node& config, int line_bits)
+    : Prefetcher(config, line_bits)
+{
+    size_t n = config["streams"].as<size_t>(16);
+    if (n == 0)
+        throw ConfigError("streams of a stream prefetcher must be positive");
+    streams.resize(n);
+    reset();
+}
+
+const char* StreamPrefetcher::get_name() const
+{
+    return "stream";
+}
+
+int StreamPrefetcher::predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines)
+{
+    if (trigger == ACCESS_HIT)
+        return 0;
+    int64_t line = addr >> line_bits;
+    time++;
+
+    Stream *s = nullptr, *lru = &streams[0];
+    for (Stream& t: streams) {
+        if (!t.valid) {
+            if (lru->valid)
+                lru = &t;
+            continue;
+        }
+        if (lru->valid && t.last_use < lru->last_use)
+            lru = &t;
+        int64_t ahead = line - t.last;
+        if (t.direction)
+            ahead *= t.direction;
+        else if (ahead < 0)
+            ahead = -ahead;
+        if (ahead >= 1 && ahead <= distance) {
+            s = &t;
+            break;
+        }
+    }
+    if (!s) {
+        *lru = {true, line, line, 0, time};
+        return 0;
+    }
+
+    if (!s->direction) {
+        s->direction = line > s->last ? 1 : -1;
+        s->next = line;
+    }
+    s->last = line;
+    s->last_use = time;
+    if ((s->next - line) * s->direction <= 0)
+        s->next = line + s->direction;
+    int count = 0;
+    while (count < degree && (s->next - line) * s->direction <= distance) {
+        lines[count++] = (uintptr_t)s->next << line_bits;
+        s->next += s->direction;
+    }
+    return count;
+}
+
+void StreamPrefetcher::reset()
+{
+    for (Stream& s: streams)
+        s = {false, 0, 0, 0, 0};
+    time = 0;
+}
+
+Prefetcher* make_prefetcher(const YAML::Node& config, int line_bits)
+{
+    string type = config["type"].as<string>("");
+    if (type == "next_line")
+        return new NextLinePrefetcher(config, line_bits);
+    if (type == "stride")
+        return new StridePrefetcher(config, line_bits);
+    if (type == "stream")
+        return new StreamPrefetcher(config, line_bits);
+    throw ConfigError("unknown prefetcher type " + type);
+}
@@ -0,0 +1,97 @@
+#ifndef PREFETCHER_HPP
+#define PREFETCHER_HPP
+
+#include <vector>
+#include <yaml-cpp/yaml.h>
+#include "types.hpp"
+
+#define MAX_PREFETCH_DEGREE 16
+
+// what a demand access did in the cache the prefetcher is attached to
+enum PrefetchTrigger
+{
+    ACCESS_HIT,
+    ACCESS_MISS,
+    ACCESS_PREFETCH_HIT,  // the first use of a prefetched line
+};
+
+/**
+ *  Watches the demand accesses of a cache and predicts the lines to bring
+ *  into it. `predict` writes at most `degree` line addresses to `lines`
+ *  and returns how many, the cache drops those it already holds.
+ */
+struct Prefetcher
+{
+    int line_bits;
+    int degree;     // lines predicted by an access at most
+    int distance;   // how far ahead of the access, in lines or strides
+
+    Prefetcher(const YAML::Node& config, int line_bits);
+    virtual const char* get_name() const = 0;
+    virtual int predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines) = 0;
+    virtual void reset() {}
+    virtual ~Prefetcher() = default;
+};
+
+// the `degree` lines from `distance` lines after a missing line or a
+// prefetched line used for the first time, i.e. tagged next-N-line
+struct NextLinePrefetcher : public Prefetcher
+{
+    NextLinePrefetcher(const YAML::Node& config, int line_bits);
+    const char* get_name() const;
+    int predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines);
+};
+
+/**
+ *  Reference prediction table indexed by the pc of the access: an entry
+ *  holds the last address and stride of its instruction, and after the
+ *  same stride is seen twice in a row the addresses `distance` to
+ *  `distance + degree - 1` strides ahead are predicted.
+ */
+struct StridePrefetcher : public Prefetcher
+{
+    struct Entry
+    {
+        reg_t pc;
+        uintptr_t last_addr;
+        int64_t stride;
+        int confidence;
+    };
+    std::vector<Entry> table;
+
+    StridePrefetcher(const YAML::Node& config, int line_bits);
+    const char* get_name() const;
+    int predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines);
+    void reset();
+};
+
+/**
+ *  Stream buffers: a miss starts a stream, and a second miss on an
+ *  adjacent line gives its direction. Each miss or use of a prefetched
+ *  line within `distance` lines ahead of a stream moves it on, and keeps
+ *  up to `distance` lines ahead of it prefetched, `degree` at a time. The
+ *  least recently used of the `streams` streams is replaced.
+ */
+struct StreamPrefetcher : public Prefetcher
+{
+    struct Stream
+    {
+        bool valid;
+        int64_t last;       // the last line used
+        int64_t next;       // the next line to prefetch
+        int direction;      // 1, -1, or 0 until known
+        uint64_t last_use;
+    };
+    std::vector<Stream> streams;
+    uint64_t time;
+
+    StreamPrefetcher(const YAML::Node& config, int line_bits);
+    const char* get_name() const;
+    int predict(uintptr_t addr, reg_t pc, PrefetchTrigger trigger, uintptr_t *lines);
+    void reset();
+};
+
+// the prefetcher of a cache, `config` has `type` next_line, stride or stream
+Prefetcher* make_prefetcher(const YAML::Node& config, int line_bits);
+
+#endif
@@ -2,13 +2,12 @@
 #include "register_def.hpp"
 using namespace std;
 
-void PipeReg::print_inst()
-{
-    if (bubble)
-        printf("         bubble\n");
-    else
-        printf("%s\n", asm_str.c_str());
-}
+const char *reg_abi_name[REG_NUM] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
 
 template<typename T>
 inline void _update(T& R, const T& r)
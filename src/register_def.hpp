@@ -2,6 +2,7 @@
 #define REGISTER_DEF_HPP
 
 #include <string>
+#include <type_traits>
 #include "types.hpp"
 
 #define REG_NUM 32
@@ -53,12 +54,11 @@ enum ALU_OP
     N_ALU_OP
 };
 
+extern const char *reg_abi_name[REG_NUM];
+
 struct PipeReg
 {
     bool stall, bubble;
-    std::string asm_str;
-
-    void print_inst();
 };
 
 struct IFReg : public PipeReg
@@ -108,9 +108,17 @@ struct WBReg : public PipeReg
     uint8_t opcode;
     reg_num_t rd;
     reg_t val;
+    reg_t pc;
 
     void update(const WBReg& r);
     void print();
 };
 
+// the pipeline copies and clears its registers every cycle, which must not
+// cost more than copying their bytes
+static_assert(std::is_trivially_copyable<IFReg>::value &&
+    std::is_trivially_copyable<IDReg>::value && std::is_trivially_copyable<EXReg>::value &&
+    std::is_trivially_copyable<MEMReg>::value && std::is_trivially_copyable<WBReg>::value,
+    "pipeline registers must be trivially copyable");
+
 #endif
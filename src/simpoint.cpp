@@ -0,0 +1,281 @@
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include "simpoint.hpp"
+using namespace std;
+
+#define KMEANS_RUNS         5    // restarts for each k, the best one is kept
+#define KMEANS_MAX_ITERS    100
+
+static inline uint64_t splitmix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// uniformly distributed in [0, 1)
+static inline double random_double(uint64_t& state)
+{
+    return (splitmix64(state) >> 11) * 0x1.0p-53;
+}
+
+static double distance2(const vector<double>& a, const vector<double>& b)
+{
+    double d = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+
+SimPointProfiler::SimPointProfiler(const YAML::Node& config)
+    : interval_size(config["interval"].as<size_t>(10000000)),
+    max_k(config["max_k"].as<int>(10)),
+    dimensions(config["dimensions"].as<int>(15)),
+    seed(config["seed"].as<uint64_t>(1))
+{
+    if (interval_size == 0 || max_k <= 0 || dimensions <= 0) {
+        cerr << "error: interval, max_k and dimensions of simpoint must be positive" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+size_t SimPointProfiler::get_interval_size() const
+{
+    return interval_size;
+}
+
+size_t SimPointProfiler::get_interval_num() const
+{
+    return points.size();
+}
+
+void SimPointProfiler::end_interval()
+{
+    size_t total = 0;
+    for (const auto &pr: block_count)
+        total += pr.second;
+
+    // each block is projected to a fixed random vector derived from its pc,
+    // so the matrix of the projection never has to be stored
+    vector<double> point(dimensions, 0);
+    for (const auto &pr: block_count) {
+        uint64_t state = seed * 0xD1B54A32D192ED03ULL + pr.first;
+        double frac = (double)pr.second / total;
+        for (int i = 0; i < dimensions; i++)
+            point[i] += frac * (random_double(state) * 2 - 1);
+    }
+    points.push_back(move(point));
+    block_count.clear();
+}
+
+/**
+ *  Cluster the points into `k` clusters, starting from centers chosen by
+ *  k-means++. Return the sum of squared distances from the points to their
+ *  centers.
+ */
+double SimPointProfiler::kmeans(int k, vector<int>& label,
+    vector<vector<double>>& center, uint64_t& rng)
+{
+    size_t n = points.size();
+    center.assign(1, points[splitmix64(rng) % n]);
+    vector<double> dist(n);
+    for (size_t i = 0; i < n; i++)
+        dist[i] = distance2(points[i], center[0]);
+    while ((int)center.size() < k) {
+        double sum = 0;
+        for (double d: dist)
+            sum += d;
+        size_t next = 0;
+        if (sum > 0) {
+            double r = random_double(rng) * sum;
+            for (; next < n - 1; next++)
+                if ((r -= dist[next]) < 0)
+                    break;
+        } else {
+            next = splitmix64(rng) % n;
+        }
+        center.push_back(points[next]);
+        for (size_t i = 0; i < n; i++)
+            dist[i] = min(dist[i], distance2(points[i], center.back()));
+    }
+
+    label.assign(n, -1);
+    double distortion = 0;
+    for (int iter = 0; iter < KMEANS_MAX_ITERS; iter++) {
+        bool changed = false;
+        distortion = 0;
+        for (size_t i = 0; i < n; i++) {
+            int nearest = 0;
+            double best = distance2(points[i], center[0]);
+            for (int c = 1; c < k; c++) {
+                double d = distance2(points[i], center[c]);
+                if (d < best) {
+                    best = d;
+                    nearest = c;
+                }
+            }
+            distortion += best;
+            if (label[i] != nearest) {
+                label[i] = nearest;
+                changed = true;
+            }
+        }
+        if (!changed)
+            break;
+
+        // move the centers to the means of their points
+        vector<vector<double>> sum(k, vector<double>(dimensions, 0));
+        vector<size_t> count(k, 0);
+        for (size_t i = 0; i < n; i++) {
+            count[label[i]]++;
+            for (int j = 0; j < dimensions; j++)
+                sum[label[i]][j] += points[i][j];
+        }
+        for (int c = 0; c < k; c++)
+            if (count[c])
+                for (int j = 0; j < dimensions; j++)
+                    center[c][j] = sum[c][j] / count[c];
+    }
+    return distortion;
+}
+
+// Bayesian information criterion of a clustering, modeling the clusters
+// as spherical gaussians with the same variance
+double SimPointProfiler::bic(int k, const vector<int>& label, double distortion)
+{
+    double R = points.size(), M = dimensions;
+    vector<size_t> size(k, 0);
+    for (int l: label)
+        size[l]++;
+
+    double variance = R > k ? distortion / (M * (R - k)) : 0;
+    variance = max(variance, 1e-12);
+    double likelihood = -R * M / 2 * log(2 * M_PI * variance) - M * (R - k) / 2;
+    for (size_t n: size)
+        if (n)
+            likelihood += n * log(n / R);
+    double params = (k - 1) + k * M + 1;
+    return likelihood - params / 2 * log(R);
+}
+
+/**
+ *  Cluster the intervals profiled so far, trying every k up to max_k and
+ *  picking the smallest one whose BIC score reaches 90% of the range of the
+ *  scores, as SimPoint does. Return the representative intervals in the
+ *  order of execution.
+ */
+vector<SimPoint> SimPointProfiler::analyze()
+{
+    vector<SimPoint> simpoints;
+    size_t n = points.size();
+    if (n == 0)
+        return simpoints;
+
+    uint64_t rng = seed;
+    int k_max = min((size_t)max_k, n);
+    vector<vector<int>> labels(k_max + 1);
+    vector<vector<vector<double>>> centers(k_max + 1);
+    vector<double> score(k_max + 1);
+    for (int k = 1; k <= k_max; k++) {
+        double best = numeric_limits<double>::infinity();
+        for (int run = 0; run < KMEANS_RUNS; run++) {
+            vector<int> label;
+            vector<vector<double>> center;
+            double distortion = kmeans(k, label, center, rng);
+            if (distortion < best) {
+                best = distortion;
+                labels[k] = move(label);
+                centers[k] = move(center);
+            }
+        }
+        score[k] = bic(k, labels[k], best);
+    }
+
+    double lo = *min_element(score.begin() + 1, score.end());
+    double hi = *max_element(score.begin() + 1, score.end());
+    int k = 1;
+    while (score[k] < lo + 0.9 * (hi - lo))
+        k++;
+
+    for (int c = 0; c < k; c++) {
+        size_t size = 0, closest = 0;
+        double best = numeric_limits<double>::infinity();
+        for (size_t i = 0; i < n; i++) {
+            if (labels[k][i] != c)
+                continue;
+            size++;
+            double d = distance2(points[i], centers[k][c]);
+            if (d < best) {
+                best = d;
+                closest = i;
+            }
+        }
+        if (size)
+            simpoints.push_back({closest, (double)size / n});
+    }
+    sort(simpoints.begin(), simpoints.end(),
+        [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+    return simpoints;
+}
+
+void write_simpoints(const string& filename, size_t interval_size,
+    size_t interval_num, const vector<SimPoint>& simpoints)
+{
+    ofstream f(filename);
+    if (!f) {
+        cerr << "error: cannot open " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+    f.precision(12);
+    f << "# interval_size " << interval_size << endl;
+    f << "# intervals " << interval_num << endl;
+    for (const auto &sp: simpoints)
+        f << sp.interval << " " << sp.weight << endl;
+}
+
+void read_simpoints(const string& filename, size_t& interval_size,
+    size_t& interval_num, vector<SimPoint>& simpoints)
+{
+    ifstream f(filename);
+    if (!f) {
+        cerr << "error: cannot open " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+    interval_size = interval_num = 0;
+    simpoints.clear();
+    string line;
+    while (getline(f, line)) {
+        if (line.empty())
+            continue;
+        if (line[0] == '#') {
+            istringstream in(line.substr(1));
+            string key;
+            size_t value;
+            if (in >> key >> value) {
+                if (key == "interval_size")
+                    interval_size = value;
+                else if (key == "intervals")
+                    interval_num = value;
+            }
+            continue;
+        }
+        istringstream in(line);
+        SimPoint sp;
+        if (!(in >> sp.interval >> sp.weight)) {
+            cerr << "error: " << filename << ": bad line `" << line << "`" << endl;
+            exit(EXIT_FAILURE);
+        }
+        simpoints.push_back(sp);
+    }
+    if (interval_size == 0 || interval_num == 0) {
+        cerr << "error: " << filename << ": missing interval_size or intervals" << endl;
+        exit(EXIT_FAILURE);
+    }
+    sort(simpoints.begin(), simpoints.end(),
+        [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+}
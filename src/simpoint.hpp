@@ -0,0 +1,56 @@
+#ifndef SIMPOINT_HPP
+#define SIMPOINT_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <yaml-cpp/yaml.h>
+#include "types.hpp"
+
+// a representative interval
+struct SimPoint
+{
+    size_t interval;  // index of the interval, counted from 0
+    double weight;    // fraction of all intervals it stands for
+};
+
+/**
+ *  SimPoint-style phase analysis. The execution is cut into intervals of a
+ *  fixed number of instructions, and the instructions executed in each basic
+ *  block during an interval form its basic block vector. The vectors are
+ *  reduced to a few dimensions by a random projection and clustered with
+ *  k-means, and the interval closest to the center of each cluster
+ *  represents it, weighted by the size of the cluster.
+ */
+class SimPointProfiler
+{
+private:
+    size_t interval_size;
+    int max_k;
+    int dimensions;
+    uint64_t seed;
+
+    // instructions executed in each basic block in the current interval
+    std::unordered_map<reg_t, size_t> block_count;
+    // the projected basic block vector of each interval
+    std::vector<std::vector<double>> points;
+
+    double kmeans(int k, std::vector<int>& label,
+        std::vector<std::vector<double>>& center, uint64_t& rng);
+    double bic(int k, const std::vector<int>& label, double distortion);
+
+public:
+    SimPointProfiler(const YAML::Node& config);
+    size_t get_interval_size() const;
+    size_t get_interval_num() const;
+    void add_block(reg_t pc, size_t length) { block_count[pc] += length; }
+    void end_interval();
+    std::vector<SimPoint> analyze();
+};
+
+void write_simpoints(const std::string& filename, size_t interval_size,
+    size_t interval_num, const std::vector<SimPoint>& simpoints);
+void read_simpoints(const std::string& filename, size_t& interval_size,
+    size_t& interval_num, std::vector<SimPoint>& simpoints);
+
+#endif
@@ -1,55 +1,55 @@
+#include <cmath>
 #include <cstring>
 #include <ctime>
 #include <csetjmp>
 #include <csignal>
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include "simulator.hpp"
-#include "decode_helpers.hpp"
+#include "execute_helpers.hpp"
+#include "alloc_counter.hpp"
 using namespace std;
 
-struct ExitEvent
-{
-    reg_t status;
-    ExitEvent(reg_t status) : status(status) {}
-};
-
-static sigjmp_buf saved_env;
+// the debugger being interrupted by Ctrl-C
+static sigjmp_buf *sigint_env;
 
 
 Simulator::Simulator(const YAML::Node& option, const YAML::Node& config, ArgumentVector&& argv)
     : disassemble(config["disassemble"].as<bool>(true)),
     single_step(option["single_step"].as<bool>(false)),
     data_forwarding(config["data_forwarding"].as<bool>(true)),
+    non_blocking(config["non_blocking"].as<bool>(false)),
     verbose(option["verbose"].as<bool>(false)),
+    quiet(option["quiet"].as<bool>(false)),
+    count_allocations(option["count_allocations"].as<bool>(false)),
+    fast_forward(option["fast_forward"].as<size_t>(0)),
+    fast_forward_to_roi(option["roi"].as<bool>(false)),
+    save_checkpoint_file(option["save_checkpoint"].as<string>("")),
+    restore_checkpoint_file(option["restore_checkpoint"].as<string>("")),
+    record_trace_file(option["record_trace"].as<string>("")),
+    record_trace_pc(config["trace"] ? config["trace"]["record_pc"].as<bool>(false) : false),
+    simpoint_profile_file(option["simpoint_profile"].as<string>("")),
+    simpoint_file(option["simpoints"].as<string>("")),
+    simpoint_config(config["simpoint"] ? config["simpoint"] : YAML::Node(YAML::NodeType::Map)),
+    simpoint_warmup(simpoint_config["warmup"].as<size_t>(1000000)),
     stack_size(config["stack_size"].as<int>(1024)),  // KB
     elf_reader(option["elf_file"].as<string>()),
     argv(argv),
-    mem_sys(config["cache"], config["memory_cycles"].as<int>(100)),
+    mem_sys(config["cache"], config["memory_cycles"].as<int>(100),
+        config["memory_backend"].as<string>("page_table"), non_blocking, config["dram"]),
+    decode_cache(mem_sys),
+    jit(nullptr),
+    trace_writer(nullptr),
+    input(&cin),
     running(false)
 {
+    mem_sys.add_code_observer(&decode_cache);
+
     // read elf file
     if (option["info_file"])
         elf_reader.output_elf_info(option["info_file"].as<string>());
 
-    if (disassemble)
-        elf_reader.load_objdump(config["objdump"].as<string>("riscv64-unknown-elf-objdump"), inst_map);
-
-    // get branch predictor
-    string bpred_str = config["branch_predictor"].as<string>("branch_history_table");
-    if (bpred_str == "never_taken")
-        br_pred = new NeverTaken();
-    else if (bpred_str == "always_taken")
-        br_pred = new AlwaysTaken();
-    else if (bpred_str == "btfnt")
-        br_pred = new BTFNT();
-    else if (bpred_str == "branch_history_table")
-        br_pred = new BranchHistoryTable();
-    else {
-        cerr << "error: no branch prediction strategy named " << bpred_str << endl;
-        exit(EXIT_FAILURE);
-    }
-
     // get alu cycles configuration
     YAML::Node alu_cycles_node = config["alu_cycles"];
     alu_cycles[ALU_ADD] = alu_cycles[ALU_SUB] = alu_cycles_node["add_sub"].as<int>(1);
@@ -68,11 +68,45 @@ Simulator::Simulator(const YAML::Node& option, const YAML::Node& config, Argumen
     ecall_cycles[SYS_sbrk] = ecall_cycles_node["sbrk"].as<int>(1000);
     ecall_cycles[SYS_readint] = ecall_cycles_node["readint"].as<int>(10000);
     ecall_cycles[SYS_time] = ecall_cycles_node["time"].as<int>(1000);
+    ecall_cycles[SYS_roi_begin] = ecall_cycles_node["roi_begin"].as<int>(0);
+
+    // get SMARTS sampling configuration
+    smarts = option["smarts"].as<bool>(false);
+    YAML::Node smarts_node = config["smarts"] ? config["smarts"] : YAML::Node(YAML::NodeType::Map);
+    smarts_period = smarts_node["period"].as<size_t>(1000000);
+    smarts_window = smarts_node["window"].as<size_t>(1000);
+    smarts_warmup = smarts_node["warmup"].as<size_t>(2000);
+    smarts_confidence = smarts_node["confidence"].as<double>(0.997);
+    smarts_target_error = smarts_node["target_error"].as<double>(0.03);
+    if (smarts && (smarts_window == 0 || smarts_period < smarts_window + smarts_warmup))
+        throw ConfigError("smarts period must be at least window + warmup, and window positive");
+    if (smarts && (smarts_confidence <= 0 || smarts_confidence >= 1 || smarts_target_error <= 0))
+        throw ConfigError("smarts confidence must be in (0, 1), and target_error positive");
+
+    // get branch predictor, then the translator, once the configuration is
+    // known to be good
+    string bpred_str = config["branch_predictor"].as<string>("branch_history_table");
+    if (bpred_str == "never_taken")
+        br_pred = new NeverTaken();
+    else if (bpred_str == "always_taken")
+        br_pred = new AlwaysTaken();
+    else if (bpred_str == "btfnt")
+        br_pred = new BTFNT();
+    else if (bpred_str == "branch_history_table")
+        br_pred = new BranchHistoryTable();
+    else
+        throw ConfigError("no branch prediction strategy named " + bpred_str);
+    if (option["jit"].as<bool>(false)) {
+        jit = new Jit(mem_sys, reg);
+        mem_sys.add_code_observer(jit);
+    }
 }
 
 Simulator::~Simulator()
 {
     delete br_pred;
+    delete jit;
+    delete trace_writer;
 }
 
 int Simulator::IF()
@@ -91,12 +125,10 @@ int Simulator::IF()
 
     int cycles = mem_sys.read_inst(pc, d.inst);
     d.pc = pc;
-    d.asm_str = inst_map[pc];
 
     // predict pc
     // real hardware implementation only need to identify branch instruction
-    EXReg r;
-    parse_inst(d.inst, r);
+    const EXReg& r = decode_cache.lookup(pc, d.inst);
     switch (r.opcode) {
     case OP_BRANCH:
         f.predPC = br_pred->predict(pc + (r.compressed_inst ? 2 : 4), pc + r.imm);
@@ -111,9 +143,10 @@ int Simulator::IF()
     return cycles;
 }
 
+template <bool forwarding>
 inline reg_t Simulator::select_reg_value(reg_num_t rs)
 {
-    if (data_forwarding && rs != 0) {
+    if (forwarding && rs != 0) {
         if (E.rd == rs) {
             switch (E.opcode) {
             case OP_JALR:
@@ -132,20 +165,34 @@ inline reg_t Simulator::select_reg_value(reg_num_t rs)
     return reg[rs];
 }
 
+template <bool forwarding>
 int Simulator::ID()
 {
+    waiting_load = false;
     if (D.bubble)
         return 0;
 
-    e.asm_str = D.asm_str;
-    e.pc = D.pc;
     // get opcode, funct3, imm, alu_op, rs1, rs2, rd, mem_op, compressed_inst
-    parse_inst(D.inst, e);
+    e = decode_cache.lookup(D.pc, D.inst);
+    e.pc = D.pc;
 
     // get the register value of rs1 and rs2
-    e.val1 = select_reg_value(e.rs1);
-    e.val2 = select_reg_value(e.rs2);
-
+    e.val1 = select_reg_value<forwarding>(e.rs1);
+    e.val2 = select_reg_value<forwarding>(e.rs2);
+
+    if (!non_blocking)
+        return 1;
+    // wait for loads in flight, an ecall may read any register. The
+    // instruction stalls while older ones are left to go on, then the
+    // cycle lasts until the data arrives.
+    uint64_t ready = max(reg_ready[e.rs1], reg_ready[e.rs2]);
+    if (e.opcode == OP_ECALL)
+        ready = *max_element(reg_ready, reg_ready + REG_NUM);
+    if (ready <= tick + 1)
+        return 1;
+    if (E.bubble && M.bubble)
+        return ready - tick;
+    waiting_load = true;
     return 1;
 }
 
@@ -154,7 +201,6 @@ int Simulator::EX()
     if (E.bubble)
         return 0;
 
-    m.asm_str = E.asm_str;
     m.opcode = E.opcode;
     m.funct3 = E.funct3;
     m.rd = E.rd;
@@ -190,45 +236,15 @@ int Simulator::EX()
         valB = E.imm;
     }
 
-    // run ALU
-    switch (E.alu_op) {
-    case ALU_ADD: m.valE = valA + valB; break;
-    case ALU_SUB: m.valE = valA - valB; break;
-    case ALU_MUL: m.valE = valA * valB; break;
-    case ALU_MULH: m.valE = ((__int128_t)valA * (__int128_t)valB) >> 64; break;
-    case ALU_MULHSU: m.valE = ((__int128_t)valA * (__uint128_t)valB) >> 64; break;
-    case ALU_MULHU: m.valE = ((__uint128_t)valA * (__uint128_t)valB) >> 64; break;
-    case ALU_DIV: m.valE = (int64_t)valA / (int64_t)valB; break;
-    case ALU_DIVU: m.valE = valA / valB; break;
-    case ALU_REM: m.valE = (int64_t)valA % (int64_t)valB; break;
-    case ALU_REMU: m.valE = valA % valB; break;
-    case ALU_SLL: m.valE = valA << valB; break;
-    case ALU_SRA: m.valE = (int64_t)valA >> valB; break;
-    case ALU_SRL: m.valE = valA >> valB; break;
-    case ALU_XOR: m.valE = valA ^ valB; break;
-    case ALU_OR: m.valE = valA | valB; break;
-    case ALU_AND: m.valE = valA & valB; break;
-    case ALU_SLT: m.valE = (int64_t)valA < (int64_t)valB; break;
-    case ALU_SLTU: m.valE = valA < valB; break;
-    default:
-        throw_error("unsupported ALU_OP: %d", E.alu_op);
-    }
-
-    // truncate for addw, subw, ...
+    // run ALU, addw, subw, ... work on 32 bits
     if (E.opcode == OP_RIW || E.opcode == OP_RRW)
-        m.valE = sign_extend(m.valE, 32);
+        m.valE = alu_execute_w(E.alu_op, valA, valB);
+    else
+        m.valE = alu_execute(E.alu_op, valA, valB);
 
     // branching
-    if (E.opcode == OP_BRANCH) {
-        switch (E.funct3) {
-        case 0x0: m.cond = E.val1 == E.val2; break;
-        case 0x1: m.cond = E.val1 != E.val2; break;
-        case 0x4: m.cond = (int64_t)E.val1 < (int64_t)E.val2; break;
-        case 0x5: m.cond = (int64_t)E.val1 >= (int64_t)E.val2; break;
-        case 0x6: m.cond = E.val1 < E.val2; break;
-        case 0x7: m.cond = E.val1 >= E.val2; break;
-        }
-    }
+    if (E.opcode == OP_BRANCH)
+        m.cond = branch_cond(E.funct3, E.val1, E.val2);
 
     return alu_cycles[E.alu_op];
 }
@@ -238,23 +254,35 @@ int Simulator::MEM()
     if (M.bubble)
         return 0;
 
-    w.asm_str = M.asm_str;
     w.opcode = M.opcode;
     w.rd = M.rd;
+    w.pc = M.pc;
 
+    // in non-blocking mode an access takes a cycle once the data cache
+    // takes it, and only the instructions using the loaded register wait
     int cycles = 1;
+    uint64_t accepted;
+    if (non_blocking && M.rd != 0)
+        reg_ready[M.rd] = 0;
     switch (M.opcode) {
     case OP_LOAD:
-        if (M.funct3 < 4) {
-            cycles = mem_sys.read_data(M.valE, w.val, 1 << M.funct3);
-            w.val = sign_extend(w.val, 8 << M.funct3);
+        if (non_blocking) {
+            uint64_t done = mem_sys.issue_read(M.valE, w.val, access_bytes(M.funct3), M.pc, accepted);
+            if (M.rd != 0)
+                reg_ready[M.rd] = done;
+            cycles = accepted - tick + 1;
         } else {
-            cycles = mem_sys.read_data(M.valE, w.val, 1 << (M.funct3 - 4));
-            w.val = zero_extend(w.val, 8 << (M.funct3 - 4));
+            cycles = mem_sys.read_data(M.valE, w.val, access_bytes(M.funct3), M.pc);
         }
+        w.val = load_extend(M.funct3, w.val);
         break;
     case OP_STORE:
-        cycles = mem_sys.write_data(M.valE, M.val2, 1 << M.funct3);
+        if (non_blocking) {
+            mem_sys.issue_write(M.valE, M.val2, access_bytes(M.funct3), M.pc, accepted);
+            cycles = accepted - tick + 1;
+        } else {
+            cycles = mem_sys.write_data(M.valE, M.val2, access_bytes(M.funct3), M.pc);
+        }
         break;
     case OP_JALR:  // jalr
     case OP_JAL:  // jal
@@ -279,6 +307,7 @@ int Simulator::WB()
     return 1;
 }
 
+template <bool forwarding>
 void Simulator::process_control_signal()
 {
     mispredicted = false;
@@ -294,7 +323,7 @@ void Simulator::process_control_signal()
 
     bool meet_ecall = (E.opcode == OP_ECALL || M.opcode == OP_ECALL || W.opcode == OP_ECALL);
     bool data_dependent = false;
-    if (data_forwarding) {
+    if (forwarding) {
         data_dependent |= (e.rs1 != 0 && e.rs1 == E.rd && E.opcode == OP_LOAD) ||
                           (e.rs2 != 0 && e.rs2 == E.rd && E.opcode == OP_LOAD);
     } else {
@@ -302,7 +331,7 @@ void Simulator::process_control_signal()
                           (e.rs2 != 0 && (E.rd == e.rs2 || M.rd == e.rs2 || W.rd == e.rs2));
     }
 
-    data_dependent |= meet_ecall;
+    data_dependent |= meet_ecall || waiting_load;
     data_dependent &= !mispredicted;
     meet_jalr &= !mispredicted && !data_dependent;
 
@@ -320,9 +349,8 @@ void Simulator::process_control_signal()
 
 void Simulator::init_stack()
 {
-    int stack_page_num = round_up(stack_size, 4);
-    for (int i = 0; i < stack_page_num; i++)
-        mem_sys.page_alloc(STACK_TOP - PGSIZE * (i + 1));
+    size_t stack_bytes = (size_t)round_up(stack_size, 4) * PGSIZE;
+    mem_sys.reserve(STACK_TOP - stack_bytes, stack_bytes);
 
     /**
      * stack layout
@@ -361,37 +389,140 @@ void Simulator::init_stack()
     mem_sys.write_data((uintptr_t)argv_store, 0, 8);
 }
 
-void Simulator::run_prog()
+void Simulator::print_stats()
+{
+    printf("instructions=%lu cycles=%lu CPI=%.3f\n", instruction_count,
+        tick, (double)tick / instruction_count);
+    printf("branch (%s): total_branch=%lu accuracy=%.3f%%\n", br_pred->get_name(),
+        total_branch, (double)correct_branch / total_branch * 100);
+    printf("mispredicted_time=%lu\n", mispredicted_time);
+    printf("meet_jalr_time=%lu\n", meet_jalr_time);
+    printf("data_dependent_time=%lu\n", data_dependent_time);
+    if (count_allocations)
+        printf("pipeline_heap_allocations=%lu\n", pipeline_allocations);
+    mem_sys.print_info(tick);
+    printf("\n");
+}
+
+void Simulator::print_exit_info(reg_t status, time_t total_time)
+{
+    printf("======== above are user output ========\n");
+    printf("program exited %lu in %ld seconds\n", status, total_time);
+    if (fast_forward || fast_forward_to_roi || !restore_checkpoint_file.empty())
+        printf("fast_forwarded_instructions=%lu\n", fast_forwarded_count);
+    print_stats();
+}
+
+SimStats Simulator::get_stats() const
+{
+    SimStats stats;
+    stats.tick = tick;
+    stats.instruction_count = instruction_count;
+    stats.total_branch = total_branch;
+    stats.correct_branch = correct_branch;
+    stats.mispredicted_time = mispredicted_time;
+    stats.meet_jalr_time = meet_jalr_time;
+    stats.data_dependent_time = data_dependent_time;
+    stats.mem = mem_sys.get_stats();
+    return stats;
+}
+
+void Simulator::set_stats(const SimStats& stats)
+{
+    tick = stats.tick;
+    instruction_count = stats.instruction_count;
+    total_branch = stats.total_branch;
+    correct_branch = stats.correct_branch;
+    mispredicted_time = stats.mispredicted_time;
+    meet_jalr_time = stats.meet_jalr_time;
+    data_dependent_time = stats.data_dependent_time;
+    mem_sys.set_stats(stats.mem);
+}
+
+// add `scale` times the counts from `begin` to `end` to `sum`
+void add_stats(SimStats& sum, const SimStats& begin, const SimStats& end, double scale)
+{
+    auto add = [scale](size_t& s, size_t b, size_t e) { s += llround((e - b) * scale); };
+    add(sum.tick, begin.tick, end.tick);
+    add(sum.instruction_count, begin.instruction_count, end.instruction_count);
+    add(sum.total_branch, begin.total_branch, end.total_branch);
+    add(sum.correct_branch, begin.correct_branch, end.correct_branch);
+    add(sum.mispredicted_time, begin.mispredicted_time, end.mispredicted_time);
+    add(sum.meet_jalr_time, begin.meet_jalr_time, end.meet_jalr_time);
+    add(sum.data_dependent_time, begin.data_dependent_time, end.data_dependent_time);
+    add(sum.mem.total_memory_access_cycles, begin.mem.total_memory_access_cycles,
+        end.mem.total_memory_access_cycles);
+    add(sum.mem.memory_access_num, begin.mem.memory_access_num, end.mem.memory_access_num);
+    sum.mem.hit_num.resize(end.mem.hit_num.size());
+    sum.mem.miss_num.resize(end.mem.miss_num.size());
+    for (size_t i = 0; i < sum.mem.hit_num.size(); i++) {
+        add(sum.mem.hit_num[i], begin.mem.hit_num[i], end.mem.hit_num[i]);
+        add(sum.mem.miss_num[i], begin.mem.miss_num[i], end.mem.miss_num[i]);
+    }
+    add(sum.mem.dram.reads, begin.mem.dram.reads, end.mem.dram.reads);
+    add(sum.mem.dram.writes, begin.mem.dram.writes, end.mem.dram.writes);
+    add(sum.mem.dram.row_hits, begin.mem.dram.row_hits, end.mem.dram.row_hits);
+    add(sum.mem.dram.row_empty, begin.mem.dram.row_empty, end.mem.dram.row_empty);
+    add(sum.mem.dram.row_conflicts, begin.mem.dram.row_conflicts, end.mem.dram.row_conflicts);
+    add(sum.mem.dram.total_latency, begin.mem.dram.total_latency, end.mem.dram.total_latency);
+    add(sum.mem.dram.busy_cycles, begin.mem.dram.busy_cycles, end.mem.dram.busy_cycles);
+}
+
+// empty the pipeline, and fetch from `pc` in the next cycle
+void Simulator::reset_pipeline(reg_t pc)
 {
-    memset(reg, 0, sizeof(reg));
     F = {};
     D = {};
     E = {};
     M = {};
     W = {};
     D.bubble = E.bubble = M.bubble = W.bubble = true;
-    stepping = false;
+    F.predPC = pc;
     mispredicted = false;
-    mem_sys.reset();
-    input_buffer.clear();
-    input_buffer.str("");
-
-    elf_reader.load_elf(F.predPC, mem_sys);
+    waiting_load = false;
+    memset(reg_ready, 0, sizeof(reg_ready));
+}
 
-    init_stack();
+/**
+ *  Run the pipeline until `inst_limit` instructions have retired in total.
+ *  Return false if the simulation is aborted by an error or the debugger.
+ */
+bool Simulator::run_pipeline(size_t inst_limit)
+{
+    // counted however the loop is left, the program exits by an exception
+    struct AllocationCount
+    {
+        size_t& sum;
+        size_t begin;
+        ~AllocationCount() { sum += heap_allocations() - begin; }
+    } allocation_count{pipeline_allocations, heap_allocations()};
+
+    // the loop is compiled for each setting of the flags, the usual run
+    // checks none of them in each cycle
+    if (single_step)
+        return data_forwarding ? run_cycles<true, false, true>(inst_limit)
+                               : run_cycles<false, false, true>(inst_limit);
+    if (verbose)
+        return data_forwarding ? run_cycles<true, true, false>(inst_limit)
+                               : run_cycles<false, true, false>(inst_limit);
+    return data_forwarding ? run_cycles<true, false, false>(inst_limit)
+                           : run_cycles<false, false, false>(inst_limit);
+}
 
-    running = true;
-    tick = 0;
-    instruction_count = 0;
-    total_branch = correct_branch = 0;
-    mispredicted_time = meet_jalr_time = data_dependent_time = 0;
-    time_t begin_time = time(NULL);
-    while (true) {
+/**
+ *  The loop of run_pipeline. `tracing` prints the pipeline in each cycle,
+ *  `debugging` stops at breakpoints for the debugger.
+ */
+template <bool forwarding, bool tracing, bool debugging>
+bool Simulator::run_cycles(size_t inst_limit)
+{
+    while (instruction_count < inst_limit) {
         f = {};
         d = {};
         e = {};
         m = {};
         w = {};
+        mem_sys.set_cycle(tick);
 
         int max_cycles = 0;
         const char *stage;
@@ -403,48 +534,38 @@ void Simulator::run_prog()
             stage = "EX";
             max_cycles = max(max_cycles, EX());
             stage = "ID";
-            max_cycles = max(max_cycles, ID());
+            max_cycles = max(max_cycles, ID<forwarding>());
             stage = "IF";
             max_cycles = max(max_cycles, IF());
             stage = "ecall";
             if (W.opcode == OP_ECALL)
                 max_cycles = max(max_cycles, process_syscall());
-        } catch (const ExitEvent& e) {
-            time_t total_time = time(NULL) - begin_time;
-            printf("======== above are user output ========\n");
-            printf("program exited %lu in %ld seconds\n", e.status, total_time);
-            printf("instructions=%lu cycles=%lu CPI=%.3f\n", instruction_count,
-                tick, (double)tick / instruction_count);
-            printf("branch (%s): total_branch=%lu accuracy=%.3f%%\n", br_pred->get_name(),
-                total_branch, (double)correct_branch / total_branch * 100);
-            printf("mispredicted_time=%lu\n", mispredicted_time);
-            printf("meet_jalr_time=%lu\n", meet_jalr_time);
-            printf("data_dependent_time=%lu\n", data_dependent_time);
-            mem_sys.print_info();
-            printf("\n");
-            break;
         } catch (const runtime_error& err) {
+            if (quiet) {
+                result.error = string("runtime_error in ") + stage + ": " + err.what();
+                return false;
+            }
             printf("======== above are user output ========\n");
             printf("runtime_error in %s: %s\n", stage, err.what());
             print_pipeline();
             print_regs();
-            mem_sys.print_info();
+            mem_sys.print_info(tick);
             printf("\n");
-            break;
+            return false;
         }
 
-        if (!single_step && verbose) {
+        if (tracing) {
             print_pipeline();
             print_regs();
         }
 
-        if (single_step && check_breakpoint(E.pc)) {
+        if (debugging && check_breakpoint(E.pc)) {
             print_pipeline();
             if (process_command() == CMD_KILL)
-                break;
+                return false;
         }
 
-        process_control_signal();
+        process_control_signal<forwarding>();
 
         if (E.opcode == OP_BRANCH) {
             total_branch++;
@@ -459,7 +580,119 @@ void Simulator::run_prog()
         M.update(m);
         W.update(w);
     }
+    return true;
+}
+
+/**
+ *  Stop the pipeline so that the functional model can take over: finish
+ *  the instruction waiting in WB, whose memory access is already done, and
+ *  drop the younger ones. Leave the pc of the oldest dropped instruction in
+ *  `pc` and return the number of instructions finished.
+ */
+size_t Simulator::drain_pipeline(reg_t& pc)
+{
+    size_t count = 0;
+    if (!W.bubble) {
+        if (W.rd != 0)
+            reg[W.rd] = W.val;
+        if (W.opcode == OP_ECALL)
+            process_syscall();
+        count++;
+    }
+
+    // a mispredicted branch in MEM has not redirected the fetch yet, so
+    // younger stages only hold instructions of the correct path
+    if (!M.bubble)
+        pc = M.pc;
+    else if (!E.bubble)
+        pc = E.pc;
+    else if (!D.bubble)
+        pc = D.pc;
+    else
+        pc = F.predPC;
+    reset_pipeline(pc);
+    return count;
+}
+
+void Simulator::run_prog()
+{
+    memset(reg, 0, sizeof(reg));
+    reset_pipeline(0);
+    stepping = false;
+    roi_reached = false;
+    mem_sys.reset();
+    input_buffer.clear();
+    input_buffer.str("");
+    if (!record_trace_file.empty()) {
+        delete trace_writer;
+        trace_writer = new TraceWriter(record_trace_file, record_trace_pc);
+        mem_sys.set_trace_writer(trace_writer);
+    }
+
+    tick = 0;
+    instruction_count = 0;
+    total_branch = correct_branch = 0;
+    mispredicted_time = meet_jalr_time = data_dependent_time = 0;
+    fast_forwarded_count = 0;
+    pipeline_allocations = 0;
+
+    if (restore_checkpoint_file.empty()) {
+        elf_reader.load_elf(F.predPC, mem_sys);
+        init_stack();
+    } else {
+        restore_checkpoint();
+    }
+
+    running = true;
+    time_t begin_time = time(NULL);
+
+    try {
+        if (!simpoint_profile_file.empty()) {
+            profile_simpoints(begin_time);
+        } else if (!simpoint_file.empty()) {
+            run_simpoints(begin_time);
+        } else {
+            // run the functional model until the region of interest, then
+            // hand the architectural state over to the pipeline, which
+            // starts empty
+            if (fast_forward_to_roi)
+                fast_forwarded_count += run_functional(F.predPC, SIZE_MAX, true);
+            if (fast_forward)
+                fast_forwarded_count += run_functional(F.predPC, fast_forward);
+            if (!save_checkpoint_file.empty()) {
+                save_checkpoint();
+                printf("======== above are user output ========\n");
+                printf("checkpoint saved to %s after %lu instructions\n\n",
+                    save_checkpoint_file.c_str(), fast_forwarded_count);
+            } else if (smarts) {
+                run_smarts(begin_time);
+            } else {
+                run_pipeline(SIZE_MAX);
+            }
+        }
+    } catch (const ExitEvent& e) {
+        result.exited = true;
+        result.status = e.status;
+        if (!quiet)
+            print_exit_info(e.status, time(NULL) - begin_time);
+    } catch (const runtime_error& err) {
+        // errors in the pipeline are reported by run_pipeline
+        if (quiet) {
+            result.error = string("runtime_error in functional model: ") + err.what();
+        } else {
+            printf("======== above are user output ========\n");
+            printf("runtime_error in functional model at pc %lx: %s\n", F.predPC, err.what());
+            print_regs();
+            mem_sys.print_info(tick);
+            printf("\n");
+        }
+    }
     running = false;
+
+    // finish writing the trace
+    mem_sys.set_trace_writer(nullptr);
+    delete trace_writer;
+    trace_writer = nullptr;
 }
 
 int Simulator::process_syscall()
@@ -469,7 +702,8 @@ int Simulator::process_syscall()
     case SYS_exit:
         throw ExitEvent(reg[REG_A0]);
     case SYS_cputchar:
-        printf("%c", (char)a1);
+        if (!quiet)
+            printf("%c", (char)a1);
         break;
     case SYS_sbrk:
         reg[REG_A0] = mem_sys.sbrk((size_t)a1);
@@ -479,7 +713,7 @@ int Simulator::process_syscall()
         if (!(input_buffer >> tmp)) {
             input_buffer.clear();
             string buf;
-            getline(cin, buf);
+            getline(*input, buf);
             input_buffer << buf;
             input_buffer >> tmp;
         }
@@ -489,6 +723,9 @@ int Simulator::process_syscall()
     case SYS_time:
         reg[REG_A0] = time(NULL);
         break;
+    case SYS_roi_begin:
+        roi_reached = true;
+        break;
     default:
         throw_error("unsupported syscall number %d", reg[REG_A7]);
     }
@@ -497,7 +734,7 @@ int Simulator::process_syscall()
 
 void SIGINT_handler(int signum)
 {
-    siglongjmp(saved_env, 1);
+    siglongjmp(*sigint_env, 1);
 }
 
 void Simulator::start()
@@ -513,6 +750,7 @@ void Simulator::start()
     printf("Notice: the program is NOT loaded until the first run.\n\n");
     while (true) {
         if (process_command() == CMD_RUN) {
+            sigint_env = &saved_env;
             auto old_handler = signal(SIGINT, SIGINT_handler);
             if (sigsetjmp(saved_env, true) == 0) {
                 run_prog();
@@ -522,9 +760,22 @@ void Simulator::start()
                 printf("received Ctrl-C, aborted\n");
                 print_pipeline();
                 print_regs();
-                mem_sys.print_info();
+                mem_sys.print_info(tick);
             }
             signal(SIGINT, old_handler);
         }
     }
 }
+
+SimResult Simulator::run_quiet(istream& in)
+{
+    input = &in;
+    result = {};
+    run_prog();
+    input = &cin;
+    result.fast_forwarded_count = fast_forwarded_count;
+    result.stats = get_stats();
+    result.branch_predictor = br_pred->get_name();
+    result.cache_names = mem_sys.get_cache_names();
+    return result;
+}
@@ -2,6 +2,9 @@
 #define SIMULATOR_HPP
 
 #include <set>
+#include <bitset>
+#include <csetjmp>
+#include <istream>
 #include <sstream>
 #include <vector>
 #include <string>
@@ -10,9 +13,44 @@
 #include "register_def.hpp"
 #include "elf_reader.hpp"
 #include "branch_predictor.hpp"
+#include "decode_cache.hpp"
+#include "jit.hpp"
+#include "simpoint.hpp"
 
 using ArgumentVector = std::vector<std::string>;
 
+// thrown by the exit syscall
+struct ExitEvent
+{
+    reg_t status;
+    ExitEvent(reg_t status) : status(status) {}
+};
+
+// counters shown by print_stats
+struct SimStats
+{
+    size_t tick;
+    size_t instruction_count;
+    size_t total_branch, correct_branch;
+    size_t mispredicted_time, meet_jalr_time, data_dependent_time;
+    MemoryStats mem;
+};
+
+// add `scale` times the counts from `begin` to `end` to `sum`
+void add_stats(SimStats& sum, const SimStats& begin, const SimStats& end, double scale = 1);
+
+// outcome of a run without output, see Simulator::run_quiet
+struct SimResult
+{
+    bool exited;        // false if the run was aborted by an error
+    reg_t status;       // exit status of the program
+    std::string error;  // the error that aborted the run
+    size_t fast_forwarded_count;
+    SimStats stats;
+    std::string branch_predictor;
+    std::vector<std::string> cache_names;
+};
+
 class Simulator
 {
 private:
@@ -20,7 +58,23 @@ private:
     bool disassemble;
     bool single_step;
     bool data_forwarding;
+    bool non_blocking;
     bool verbose;
+    bool quiet;
+    bool count_allocations;
+    size_t fast_forward;
+    bool fast_forward_to_roi;
+    std::string save_checkpoint_file;
+    std::string restore_checkpoint_file;
+    std::string record_trace_file;
+    bool record_trace_pc;
+    std::string simpoint_profile_file;
+    std::string simpoint_file;
+    YAML::Node simpoint_config;
+    size_t simpoint_warmup;
+    bool smarts;
+    size_t smarts_period, smarts_window, smarts_warmup;
+    double smarts_confidence, smarts_target_error;
     int stack_size;
     int alu_cycles[N_ALU_OP];
     int ecall_cycles[NSYSCALLS];
@@ -28,7 +82,6 @@ private:
 
     // elf file related
     ElfReader elf_reader;
-    InstructionMap inst_map;
     ArgumentVector argv;
 
     // performace count
@@ -36,6 +89,8 @@ private:
     size_t instruction_count;
     size_t total_branch, correct_branch;
     size_t mispredicted_time, meet_jalr_time, data_dependent_time;
+    size_t fast_forwarded_count;
+    size_t pipeline_allocations;  // heap allocations in run_pipeline
 
     // uppercase refer to pipeline registers, lowercase refer to
     // the signal to be written to the corresponding registers
@@ -47,26 +102,74 @@ private:
 
     // bypass registers
     bool mispredicted;
+    bool waiting_load;  // the instruction in ID waits for a load in flight
+
+    // set by the roi_begin syscall
+    bool roi_reached;
 
     reg_t reg[REG_NUM];
+    // non-blocking mode: the cycle the data of the load writing each
+    // register arrives, which the instructions reading it wait for
+    uint64_t reg_ready[REG_NUM];
     MemorySystem mem_sys;
+    DecodeCache decode_cache;
+    Jit *jit;
+    TraceWriter *trace_writer;
+    std::istream *input;
     std::stringstream input_buffer;
+    SimResult result;
 
     int IF();
+    template <bool forwarding>
     reg_t select_reg_value(reg_num_t rs);
+    template <bool forwarding>
     int ID();
     int EX();
     int MEM();
     int WB();
     int process_syscall();
+    template <bool forwarding>
     void process_control_signal();
     void init_stack();
+    void print_stats();
+    void print_exit_info(reg_t status, time_t total_time);
+    SimStats get_stats() const;
+    void set_stats(const SimStats& stats);
+    void reset_pipeline(reg_t pc);
+    bool run_pipeline(size_t inst_limit);
+    template <bool forwarding, bool tracing, bool debugging>
+    bool run_cycles(size_t inst_limit);
+    size_t drain_pipeline(reg_t& pc);
     void run_prog();
 
+    // functional model, used for fast-forwarding
+    template <bool warming>
+    bool step_functional(reg_t& pc);
+    size_t run_functional(reg_t& pc, size_t max_inst, bool stop_at_roi = false);
+    size_t run_warming(reg_t& pc, size_t max_inst);
+    void run_functional_profile(reg_t& pc, SimPointProfiler& profiler);
+
+    // SimPoint sampling
+    void profile_simpoints(time_t begin_time);
+    void run_simpoints(time_t begin_time);
+
+    // SMARTS sampling
+    void run_smarts(time_t begin_time);
+
+    // checkpoints
+    void transfer_state(FILE *file, bool saving);
+    void save_checkpoint();
+    void restore_checkpoint();
+
     // debug related
     bool running;
     bool stepping;
     std::set<uintptr_t> breakpoints;
+    // bit `(pc >> 1) % size` is set for every breakpoint, so most
+    // instructions are passed without looking up the set
+    std::bitset<4096> breakpoint_filter;
+    ArgumentVector cmdline;
+    sigjmp_buf saved_env;
     enum cmd_num_t {
         CMD_CONTINUE,
         CMD_RUN,
@@ -74,6 +177,7 @@ private:
     };
 
     void print_regs();
+    void print_inst(const PipeReg& r, reg_t pc);
     void print_pipeline();
     bool check_breakpoint(reg_t pc);
     uint64_t evaluate(const std::string& exp);
@@ -83,6 +187,8 @@ public:
     Simulator(const YAML::Node& option, const YAML::Node& config, ArgumentVector&& argv);
     ~Simulator();
     void start();
+    // run the program once, reading `in` for readint and printing nothing
+    SimResult run_quiet(std::istream& in);
 };
 
 #endif
@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "simulator.hpp"
+#include "checkpoint.hpp"
+using namespace std;
+
+/**
+ *  Write the state of the simulator besides the memory system when
+ *  `saving`, otherwise read it back. The pipeline registers are transferred
+ *  field by field.
+ */
+void Simulator::transfer_state(FILE *file, bool saving)
+{
+    auto io = [file, saving](auto& field) { checkpoint_transfer(file, field, saving); };
+
+    io(fast_forwarded_count);
+    io(reg);
+
+    io(F.stall); io(F.bubble); io(F.predPC);
+    io(D.stall); io(D.bubble); io(D.inst); io(D.pc);
+    io(E.stall); io(E.bubble); io(E.compressed_inst); io(E.opcode); io(E.funct3);
+    io(E.rs1); io(E.rs2); io(E.rd); io(E.alu_op); io(E.val1); io(E.val2); io(E.imm); io(E.pc);
+    io(M.stall); io(M.bubble); io(M.opcode); io(M.funct3); io(M.rd); io(M.cond);
+    io(M.valE); io(M.val2); io(M.pc);
+    io(W.stall); io(W.bubble); io(W.opcode); io(W.rd); io(W.val); io(W.pc);
+    io(mispredicted);
+
+    // the rest of the line buffered by readint
+    string input;
+    if (saving && input_buffer.tellg() >= 0)
+        input = input_buffer.str().substr(input_buffer.tellg());
+    io(input);
+    if (!saving) {
+        input_buffer.clear();
+        input_buffer.str(input);
+    }
+
+    string name = br_pred->get_name(), state = br_pred->get_state();
+    io(name);
+    io(state);
+    if (!saving) {
+        if (name == br_pred->get_name() && state.size() == br_pred->get_state().size())
+            br_pred->set_state(state);
+        else
+            cerr << "warning: the branch predictor differs from the checkpoint, starting it cold" << endl;
+    }
+}
+
+void Simulator::save_checkpoint()
+{
+    FILE *file = fopen(save_checkpoint_file.c_str(), "wb");
+    if (!file)
+        throw runtime_error("cannot open " + save_checkpoint_file);
+    uint32_t version = CHECKPOINT_VERSION;
+    checkpoint_write(file, CHECKPOINT_MAGIC, 8);
+    checkpoint_write(file, &version, sizeof(version));
+    transfer_state(file, true);
+    mem_sys.save(file);
+    fclose(file);
+}
+
+void Simulator::restore_checkpoint()
+{
+    FILE *file = fopen(restore_checkpoint_file.c_str(), "rb");
+    if (!file)
+        throw runtime_error("cannot open " + restore_checkpoint_file);
+    try {
+        char magic[8];
+        uint32_t version;
+        checkpoint_read(file, magic, sizeof(magic));
+        checkpoint_read(file, &version, sizeof(version));
+        if (memcmp(magic, CHECKPOINT_MAGIC, 8) != 0 || version != CHECKPOINT_VERSION)
+            throw runtime_error("not a checkpoint of this simulator");
+        transfer_state(file, false);
+        mem_sys.restore(file);
+    } catch (const runtime_error& err) {
+        fclose(file);
+        throw runtime_error(restore_checkpoint_file + ": " + err.what());
+    }
+    fclose(file);
+}
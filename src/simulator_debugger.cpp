@@ -1,15 +1,9 @@
 #include <string>
 #include <iostream>
 #include "simulator.hpp"
+#include "decode_helpers.hpp"
 using namespace std;
 
-const char *reg_abi_name[32] = {
-    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
-    "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
-    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
-    "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
-};
-
 void Simulator::print_regs()
 {
     printf("    Registers:");
@@ -21,19 +15,38 @@ void Simulator::print_regs()
     printf("\n\n");
 }
 
+// the instruction is disassembled from memory only when printed
+void Simulator::print_inst(const PipeReg& r, reg_t pc)
+{
+    if (r.bubble) {
+        printf("         bubble\n");
+        return;
+    }
+    if (!disassemble) {
+        printf("\n");
+        return;
+    }
+    string asm_str;
+    try {
+        asm_str = disassemble_inst(mem_sys.fetch_inst(pc), pc);
+    } catch (const runtime_error&) {
+        asm_str = "(invalid address)";
+    }
+    printf("%5lx:   %s\n", pc, asm_str.c_str());
+}
+
 void Simulator::print_pipeline()
 {
     printf("\ntick = %lu\n", tick);
-    // printf("    IF: %s\n", inst_map[F.predPC].c_str());
-    printf("    IF: "); d.print_inst();  // `d` has the correct instruction
+    printf("    IF: "); print_inst(d, d.pc);  // `d` has the correct instruction
     F.print();
-    printf("    ID: "); D.print_inst();
+    printf("    ID: "); print_inst(D, D.pc);
     D.print();
-    printf("    EX: "); E.print_inst();
+    printf("    EX: "); print_inst(E, E.pc);
     E.print();
-    printf("    MM: "); M.print_inst();
+    printf("    MM: "); print_inst(M, M.pc);
     M.print();
-    printf("    WB: "); W.print_inst();
+    printf("    WB: "); print_inst(W, W.pc);
     W.print();
 }
 
@@ -43,7 +56,7 @@ bool Simulator::check_breakpoint(reg_t pc)
         stepping = false;
         return true;
     }
-    return breakpoints.count(pc) > 0;
+    return breakpoint_filter[(pc >> 1) % breakpoint_filter.size()] && breakpoints.count(pc) > 0;
 }
 
 uint64_t Simulator::evaluate(const string& exp)
@@ -97,7 +110,6 @@ void split(const string& s, ArgumentVector& result, char delim)
 
 Simulator::cmd_num_t Simulator::process_command()
 {
-    static ArgumentVector cmdline;
     while (true) {
         printf("(sim) "); fflush(stdout);
         string line;
@@ -136,6 +148,7 @@ Simulator::cmd_num_t Simulator::process_command()
                 EXPECT_EXPRESSION(1);
                 uintptr_t addr = evaluate(cmdline[1]);
                 breakpoints.insert(addr);
+                breakpoint_filter.set((addr >> 1) % breakpoint_filter.size());
                 printf("added breakpoint at 0x%lx\n", addr);
             }
             else if (is_prefix(cmd, "print")) {
@@ -0,0 +1,153 @@
+#include "simulator.hpp"
+#include "execute_helpers.hpp"
+using namespace std;
+
+// execute the instruction at `pc` and advance `pc`, return whether it
+// ends a basic block. When `warming`, the accesses also go through the
+// caches and branches train the branch predictor.
+template <bool warming>
+inline bool Simulator::step_functional(reg_t& pc)
+{
+    inst_t inst;
+    if (warming)
+        mem_sys.read_inst(pc, inst);
+    else
+        inst = mem_sys.fetch_inst(pc);
+    const EXReg& r = decode_cache.lookup(pc, inst);
+    reg_t val1 = reg[r.rs1], val2 = reg[r.rs2];
+    reg_t next_pc = pc + (r.compressed_inst ? 2 : 4);
+    reg_t val = 0;
+
+    switch (r.opcode) {
+    case OP_RR:
+        val = alu_execute(r.alu_op, val1, val2);
+        break;
+    case OP_RRW:
+        val = alu_execute_w(r.alu_op, val1, val2);
+        break;
+    case OP_RIW:
+        val = alu_execute_w(r.alu_op, val1, r.imm);
+        break;
+    case OP_BRANCH: {
+        bool taken = branch_cond(r.funct3, val1, val2);
+        if (warming)
+            br_pred->feedback(next_pc, taken);
+        if (taken)
+            next_pc = pc + r.imm;
+        break;
+    }
+    case OP_AUIPC:
+        val = pc + r.imm;
+        break;
+    case OP_JAL:
+        val = next_pc;
+        next_pc = pc + r.imm;
+        break;
+    case OP_JALR:
+        val = next_pc;
+        next_pc = val1 + r.imm;
+        break;
+    case OP_LOAD:
+        if (warming)
+            mem_sys.read_data(val1 + r.imm, val, access_bytes(r.funct3), pc);
+        else
+            val = mem_sys.load(val1 + r.imm, access_bytes(r.funct3));
+        val = load_extend(r.funct3, val);
+        break;
+    case OP_STORE:
+        if (warming)
+            mem_sys.write_data(val1 + r.imm, val2, access_bytes(r.funct3), pc);
+        else
+            mem_sys.store(val1 + r.imm, val2, access_bytes(r.funct3));
+        break;
+    case OP_ECALL:
+        process_syscall();
+        break;
+    default:
+        val = alu_execute(r.alu_op, val1, r.imm);
+    }
+
+    if (r.rd != 0)
+        reg[r.rd] = val;
+
+    pc = next_pc;
+    return r.opcode == OP_BRANCH || r.opcode == OP_JAL ||
+        r.opcode == OP_JALR || r.opcode == OP_ECALL;
+}
+
+/**
+ *  Execute instructions one at a time without the pipeline, caches or
+ *  branch predictor, starting from `pc`. Stop after `max_inst` instructions,
+ *  or right after the roi_begin syscall if `stop_at_roi` is set, and leave
+ *  the pc of the next instruction in `pc`.
+ *  Return the number of instructions executed.
+ */
+size_t Simulator::run_functional(reg_t& pc, size_t max_inst, bool stop_at_roi)
+{
+    size_t count = 0;
+    roi_reached = false;
+    while (count < max_inst && !(stop_at_roi && roi_reached)) {
+        // translated code runs until an instruction it leaves to the
+        // interpreter, such as ecall
+        if (jit) {
+            count += jit->run(pc, max_inst - count);
+            if (count == max_inst)
+                break;
+        }
+        step_functional<false>(pc);
+        count++;
+    }
+    return count;
+}
+
+/**
+ *  Execute `max_inst` instructions from `pc` like run_functional, but keep
+ *  the caches and the branch predictor warm, so that the pipeline can take
+ *  over at any point without a cold start. The clock stands still meanwhile,
+ *  so the times of the accesses in flight are dropped at the end.
+ */
+size_t Simulator::run_warming(reg_t& pc, size_t max_inst)
+{
+    size_t count = 0;
+    mem_sys.set_warming(true);
+    for (; count < max_inst; count++)
+        step_functional<true>(pc);
+    mem_sys.set_warming(false);
+    mem_sys.reset_timing();
+    return count;
+}
+
+/**
+ *  Execute instructions from `pc` until the program exits, counting the
+ *  instructions executed in each basic block for `profiler` and ending its
+ *  intervals every `profiler.get_interval_size()` instructions. A block
+ *  running across the end of an interval is split there. The interval cut
+ *  short by the exit is ended too.
+ */
+void Simulator::run_functional_profile(reg_t& pc, SimPointProfiler& profiler)
+{
+    size_t interval_size = profiler.get_interval_size();
+    size_t interval_length = 0, block_length = 0;
+    reg_t block_pc = pc;
+    try {
+        while (true) {
+            bool block_end = step_functional<false>(pc);
+            block_length++;
+            if (++interval_length == interval_size || block_end) {
+                profiler.add_block(block_pc, block_length);
+                block_pc = pc;
+                block_length = 0;
+            }
+            if (interval_length == interval_size) {
+                profiler.end_interval();
+                interval_length = 0;
+            }
+        }
+    } catch (const ExitEvent& e) {
+        if (block_length)
+            profiler.add_block(block_pc, block_length);
+        if (interval_length)
+            profiler.end_interval();
+        throw;
+    }
+}
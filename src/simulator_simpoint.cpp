@@ -0,0 +1,91 @@
+#include <ctime>
+#include "simulator.hpp"
+using namespace std;
+
+/**
+ *  Run the whole program in the functional model, collecting a basic block
+ *  vector for every interval, then pick the representative intervals and
+ *  write them to the simpoint file.
+ */
+void Simulator::profile_simpoints(time_t begin_time)
+{
+    SimPointProfiler profiler(simpoint_config);
+    reg_t status = 0;
+    try {
+        run_functional_profile(F.predPC, profiler);
+    } catch (const ExitEvent& e) {
+        status = e.status;
+    }
+
+    vector<SimPoint> simpoints = profiler.analyze();
+    write_simpoints(simpoint_profile_file, profiler.get_interval_size(),
+        profiler.get_interval_num(), simpoints);
+
+    printf("======== above are user output ========\n");
+    printf("program exited %lu in %ld seconds\n", status, time(NULL) - begin_time);
+    printf("intervals=%lu interval_size=%lu simpoints=%lu\n", profiler.get_interval_num(),
+        profiler.get_interval_size(), simpoints.size());
+    for (const auto &sp: simpoints)
+        printf("    interval=%-10lu weight=%.3f\n", sp.interval, sp.weight);
+    printf("simpoints written to %s\n\n", simpoint_profile_file.c_str());
+}
+
+/**
+ *  Simulate only the intervals listed in the simpoint file in the pipeline,
+ *  and the rest in the functional model. Each interval is preceded by up to
+ *  `simpoint_warmup` instructions in the pipeline to warm up the caches and
+ *  the branch predictor. The counters of every interval, scaled by the
+ *  number of intervals it stands for, add up to an estimate for the whole
+ *  program.
+ */
+void Simulator::run_simpoints(time_t begin_time)
+{
+    size_t interval_size, interval_num;
+    vector<SimPoint> simpoints;
+    read_simpoints(simpoint_file, interval_size, interval_num, simpoints);
+
+    SimStats sum = {}, begin;
+    size_t position = 0;  // instructions executed so far
+    size_t simulated = 0;
+    bool measuring = false;
+    double scale = 0;
+    try {
+        for (const auto &sp: simpoints) {
+            size_t start = sp.interval * interval_size;
+            size_t warmup_start = start > simpoint_warmup ? start - simpoint_warmup : 0;
+            if (warmup_start > position)
+                position += run_functional(F.predPC, warmup_start - position);
+
+            reset_pipeline(F.predPC);
+            size_t retired = instruction_count;
+            // the instruction finished by draining the last interval may
+            // already belong to this one
+            if (!run_pipeline(instruction_count + (start > position ? start - position : 0)))
+                return;
+            begin = get_stats();
+            measuring = true;
+            scale = sp.weight * interval_num;
+            if (!run_pipeline(instruction_count + interval_size))
+                return;
+            add_stats(sum, begin, get_stats(), scale);
+            measuring = false;
+            simulated++;
+
+            position += instruction_count - retired;
+            position += drain_pipeline(F.predPC);
+        }
+    } catch (const ExitEvent& e) {
+        // the program ended in an interval, count the part simulated
+        if (measuring) {
+            add_stats(sum, begin, get_stats(), scale);
+            simulated++;
+        }
+    }
+
+    set_stats(sum);
+    printf("======== above are user output ========\n");
+    printf("simulated %lu of %lu simpoints in %ld seconds\n", simulated,
+        simpoints.size(), time(NULL) - begin_time);
+    printf("estimated for %lu intervals of %lu instructions:\n", interval_num, interval_size);
+    print_stats();
+}
@@ -0,0 +1,157 @@
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include "simulator.hpp"
+using namespace std;
+
+// a ratio of two counters estimated from the sampled windows
+struct RatioEstimate
+{
+    double value;   // sum(y) / sum(x) over the windows
+    double error;   // half width of the confidence interval
+    size_t needed;  // windows needed to reach the target relative error
+};
+
+/**
+ *  Estimate sum(y) / sum(x) treating the windows as a random sample of the
+ *  execution. The variance comes from the residuals y - value * x of the
+ *  windows, as for any ratio estimator; `z` is the standard score of the
+ *  confidence level.
+ */
+static RatioEstimate estimate_ratio(const vector<double>& y, const vector<double>& x,
+    double z, double target_error)
+{
+    RatioEstimate est = {NAN, INFINITY, 0};
+    size_t n = y.size();
+    double sum_y = 0, sum_x = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum_y += y[i];
+        sum_x += x[i];
+    }
+    if (sum_x == 0)
+        return est;
+    est.value = sum_y / sum_x;
+    if (n < 2)
+        return est;
+
+    double residual = 0;
+    for (size_t i = 0; i < n; i++)
+        residual += (y[i] - est.value * x[i]) * (y[i] - est.value * x[i]);
+    // standard deviation of the ratio in a single window
+    double sd = sqrt(residual / (n - 1)) / (sum_x / n);
+    est.error = z * sd / sqrt(n);
+    if (est.value > 0)
+        est.needed = ceil(pow(z * sd / (target_error * est.value), 2));
+    return est;
+}
+
+// standard score of a two-sided confidence level
+static double z_score(double confidence)
+{
+    // solve erfc(z / sqrt(2)) == 1 - confidence by bisection
+    double lo = 0, hi = 40;
+    for (int i = 0; i < 100; i++) {
+        double mid = (lo + hi) / 2;
+        if (erfc(mid / M_SQRT2) > 1 - confidence)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void print_estimate(const char *name, const char *prefix,
+    const RatioEstimate& est, bool percent)
+{
+    double unit = percent ? 100 : 1;
+    const char *sign = percent ? "%" : "";
+    if (isnan(est.value)) {
+        printf("%20s: %sn/a\n", name, prefix);
+        return;
+    }
+    printf("%20s: %s%.3f%s +- %.3f%s", name, prefix, est.value * unit, sign,
+        est.error * unit, sign);
+    if (est.value > 0 && isfinite(est.error))
+        printf(" (%.2f%%)", est.error / est.value * 100);
+    printf("\n");
+}
+
+/**
+ *  SMARTS-style systematic sampling. Every `smarts_period` instructions,
+ *  the pipeline runs `smarts_warmup` instructions to fill up and then
+ *  measures a window of `smarts_window` instructions. The instructions in
+ *  between run in the functional model with the caches and the branch
+ *  predictor kept warm. The windows are a sample of the whole execution,
+ *  which gives confidence intervals for CPI, the branch prediction accuracy
+ *  and the miss rate of each cache.
+ */
+void Simulator::run_smarts(time_t begin_time)
+{
+    vector<SimStats> windows;
+    SimStats sum = {};
+    reg_t status = 0;
+    try {
+        while (true) {
+            run_warming(F.predPC, smarts_period - smarts_warmup - smarts_window);
+            reset_pipeline(F.predPC);
+            if (!run_pipeline(instruction_count + smarts_warmup))
+                return;
+            SimStats begin = get_stats();
+            if (!run_pipeline(instruction_count + smarts_window))
+                return;
+            SimStats end = get_stats(), window = {};
+            add_stats(window, begin, end);
+            add_stats(sum, begin, end);
+            windows.push_back(window);
+            drain_pipeline(F.predPC);
+        }
+    } catch (const ExitEvent& e) {
+        // a window cut short by the exit is dropped
+        status = e.status;
+    }
+
+    // the report covers the measured windows only
+    set_stats(sum);
+    print_exit_info(status, time(NULL) - begin_time);
+
+    size_t n = windows.size();
+    double z = z_score(smarts_confidence);
+    printf("sampling: windows=%lu window=%lu warmup=%lu period=%lu\n", n,
+        smarts_window, smarts_warmup, smarts_period);
+    printf("confidence intervals (%.1f%%):\n", smarts_confidence * 100);
+
+    vector<double> y(n), x(n);
+    for (size_t i = 0; i < n; i++) {
+        y[i] = windows[i].tick;
+        x[i] = windows[i].instruction_count;
+    }
+    RatioEstimate cpi = estimate_ratio(y, x, z, smarts_target_error);
+    print_estimate("CPI", "", cpi, false);
+
+    for (size_t i = 0; i < n; i++) {
+        y[i] = windows[i].correct_branch;
+        x[i] = windows[i].total_branch;
+    }
+    print_estimate("branch", "accuracy=", estimate_ratio(y, x, z, smarts_target_error), true);
+
+    vector<string> names = mem_sys.get_cache_names();
+    for (size_t c = 0; c < names.size(); c++) {
+        for (size_t i = 0; i < n; i++) {
+            y[i] = windows[i].mem.miss_num[c];
+            x[i] = windows[i].mem.hit_num[c] + windows[i].mem.miss_num[c];
+        }
+        print_estimate(names[c].c_str(), "miss_rate=",
+            estimate_ratio(y, x, z, smarts_target_error), true);
+    }
+
+    // the target applies to CPI, as in SMARTS
+    if (n >= 2 && cpi.error <= smarts_target_error * cpi.value) {
+        printf("more_samples_needed=no (target error %.2f%% of CPI)\n", smarts_target_error * 100);
+    } else {
+        printf("more_samples_needed=yes (target error %.2f%% of CPI", smarts_target_error * 100);
+        if (cpi.needed)
+            printf(", about %lu windows needed", cpi.needed);
+        printf(")\n");
+    }
+    printf("\n");
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <algorithm>
+#include "stack_distance.hpp"
+using namespace std;
+
+static inline bool is_power_of_2(size_t x)
+{
+    return x && !(x & (x - 1));
+}
+
+static inline int log2(size_t x)
+{
+    int ret = 0;
+    for (; x > 1; x >>= 1)
+        ret++;
+    return ret;
+}
+
+StackDistance::StackDistance()
+    : now(0)
+{
+}
+
+void StackDistance::add(uint32_t i, int delta)
+{
+    for (; i < tree.size(); i += i & -i)
+        tree[i] += delta;
+}
+
+uint32_t StackDistance::prefix(uint32_t i) const
+{
+    uint32_t sum = 0;
+    for (; i; i -= i & -i)
+        sum += tree[i];
+    return sum;
+}
+
+// renumber the times of the lines as 1..n in the same order
+void StackDistance::compact()
+{
+    vector<pair<uint32_t, uint64_t>> order;
+    order.reserve(last.size());
+    for (const auto &pr: last)
+        order.push_back({pr.second, pr.first});
+    sort(order.begin(), order.end());
+
+    tree.assign(max<size_t>(2 * (order.size() + 1), 16), 0);
+    now = 0;
+    for (const auto &pr: order) {
+        last[pr.second] = ++now;
+        add(now, 1);
+    }
+}
+
+size_t StackDistance::access(uint64_t line)
+{
+    if (now + 1 >= tree.size())
+        compact();
+    now++;
+    size_t distance = SIZE_MAX;
+    auto it = last.find(line);
+    if (it != last.end()) {
+        // the marks after the last reference, itself excluded
+        distance = last.size() - prefix(it->second);
+        add(it->second, -1);
+        it->second = now;
+    } else {
+        last.emplace(line, now);
+    }
+    add(now, 1);
+    return distance;
+}
+
+StackDistanceAnalyzer::StackDistanceAnalyzer(const YAML::Node& config)
+    : access_num(0)
+{
+    size_t line_size = config["cache_line_bytes"].as<size_t>(64);
+    size_t min_size = config["min_size"].as<size_t>(1) * 1024;  // KB => Bytes
+    size_t max_size = config["max_size"].as<size_t>(8192) * 1024;
+    max_associativity = config["max_associativity"].as<size_t>(16);
+    if (!is_power_of_2(line_size) || !is_power_of_2(min_size) || !is_power_of_2(max_size) ||
+        !is_power_of_2(max_associativity) || min_size < line_size || min_size > max_size) {
+        cerr << "error: cache_line_bytes, min_size, max_size and max_associativity of "
+            "stack_distance must be powers of 2, with line <= min_size <= max_size" << endl;
+        exit(EXIT_FAILURE);
+    }
+    line_bits = log2(line_size);
+    min_lines = min_size / line_size;
+    max_lines = max_size / line_size;
+
+    full_hist.assign(max_lines + 1, 0);
+    // the sets of every capacity and associativity up to the maximum
+    levels.resize(log2(max_lines) + 1);
+    for (size_t level = 1; level < levels.size(); level++) {
+        size_t sets = (size_t)1 << level;
+        if (sets * max_associativity < min_lines)
+            continue;
+        Level& l = levels[level];
+        l.depth = min(max_associativity, max_lines / sets);
+        l.stack.assign(sets * l.depth, 0);
+        l.hist.assign(l.depth + 1, 0);
+    }
+}
+
+void StackDistanceAnalyzer::access(uintptr_t addr)
+{
+    uint64_t line = addr >> line_bits;
+    access_num++;
+    full_hist[min(full.access(line), max_lines)]++;
+
+    for (size_t level = 1; level < levels.size(); level++) {
+        Level& l = levels[level];
+        if (l.stack.empty())
+            continue;
+        // move the line to the front of its set, 0 marks an empty slot
+        uint64_t *stack = &l.stack[(line & (((size_t)1 << level) - 1)) * l.depth];
+        uint64_t entry = line + 1;
+        size_t distance = 0;
+        while (distance < l.depth && stack[distance] != entry)
+            distance++;
+        l.hist[distance]++;
+        for (size_t i = min(distance, l.depth - 1); i > 0; i--)
+            stack[i] = stack[i - 1];
+        stack[0] = entry;
+    }
+}
+
+uint64_t StackDistanceAnalyzer::hits(size_t sets, size_t associativity) const
+{
+    const vector<uint64_t>& hist = sets == 1 ? full_hist : levels[log2(sets)].hist;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < associativity; i++)
+        sum += hist[i];
+    return sum;
+}
+
+void StackDistanceAnalyzer::print_info() const
+{
+    printf("stack distance analysis: accesses=%lu cache_line_bytes=%d\n", access_num, 1 << line_bits);
+    printf("miss rate (%%) of LRU caches:\n");
+    printf("%10s", "size");
+    for (size_t a = 1; a <= max_associativity; a <<= 1)
+        printf(" %8lu-way", a);
+    printf(" %12s\n", "full");
+    for (size_t lines = min_lines; lines <= max_lines; lines <<= 1) {
+        size_t bytes = lines << line_bits;
+        if (bytes >= 1024 * 1024)
+            printf("%8luMB", bytes / 1024 / 1024);
+        else
+            printf("%8luKB", bytes / 1024);
+        for (size_t a = 1; a <= max_associativity; a <<= 1) {
+            if (a > lines)
+                printf(" %12s", "-");
+            else
+                printf(" %12.3f", (1 - (double)hits(lines / a, a) / access_num) * 100);
+        }
+        printf(" %12.3f\n", (1 - (double)hits(1, lines) / access_num) * 100);
+    }
+    printf("\n");
+}
@@ -0,0 +1,73 @@
+#ifndef STACK_DISTANCE_HPP
+#define STACK_DISTANCE_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <yaml-cpp/yaml.h>
+#include "types.hpp"
+
+/**
+ *  LRU stack distances of a stream of lines: the number of distinct other
+ *  lines referenced since the last reference to the same line. The time of
+ *  the last reference to every line is marked in a Fenwick tree, so the
+ *  distance is the number of marks after that time, found in O(log n).
+ *  The times are renumbered when the tree is full, keeping its size within
+ *  twice the number of distinct lines.
+ */
+class StackDistance
+{
+private:
+    std::unordered_map<uint64_t, uint32_t> last;  // time of the last reference
+    std::vector<uint32_t> tree;  // 1-based
+    uint32_t now;
+
+    void add(uint32_t i, int delta);
+    uint32_t prefix(uint32_t i) const;
+    void compact();
+
+public:
+    StackDistance();
+    // reference `line`, return its distance or SIZE_MAX on the first reference
+    size_t access(uint64_t line);
+};
+
+/**
+ *  Mattson's one-pass analysis of a memory trace. For every power-of-two
+ *  number of sets, each set keeps an LRU stack of the lines mapped to it;
+ *  an access hits in an LRU cache with that many sets and associativity A
+ *  exactly when its distance in the stack is less than A. One pass thus
+ *  gives the miss rates of every power-of-two capacity and associativity at
+ *  a line size. The stack of the fully associative caches can be as deep as
+ *  the largest one and uses a StackDistance, the stacks of the sets only
+ *  matter up to the largest associativity and are short arrays.
+ */
+class StackDistanceAnalyzer
+{
+private:
+    int line_bits;
+    size_t min_lines, max_lines;
+    size_t max_associativity;
+    size_t access_num;
+
+    StackDistance full;
+    std::vector<uint64_t> full_hist;  // of distances, the last bucket for the rest
+
+    // the caches with `1 << level` sets
+    struct Level
+    {
+        size_t depth;
+        std::vector<uint64_t> stack;  // `depth` entries per set, MRU first
+        std::vector<uint64_t> hist;
+    };
+    std::vector<Level> levels;
+
+    uint64_t hits(size_t sets, size_t associativity) const;
+
+public:
+    StackDistanceAnalyzer(const YAML::Node& config);
+    void access(uintptr_t addr);
+    void print_info() const;
+};
+
+#endif
@@ -0,0 +1,387 @@
+#include <cmath>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+#include "sweep.hpp"
+using namespace std;
+
+#define INDEX_NONE  -2  // the step does not index into a list
+#define INDEX_ALL   -1  // `[*]`, every element of the list
+
+// one step of a key path, such as `cache[*]` or `size`
+struct PathStep
+{
+    string key;
+    int index;
+};
+
+// a key of the grid and the values it takes
+struct GridKey
+{
+    string name;
+    vector<PathStep> path;
+    vector<string> values;
+};
+
+// a configuration to simulate, and its result
+struct SweepJob
+{
+    string config_name;
+    vector<string> values;  // of the grid keys
+    YAML::Node config;
+    YAML::Node option;
+    SimResult result;
+};
+
+// a cell of the output, `number` tells JSON not to quote it
+struct Field
+{
+    string text;
+    bool number;
+};
+
+using Row = map<string, Field>;
+
+static YAML::Node load_config(const string& filename)
+{
+    try {
+        return YAML::LoadFile(filename);
+    } catch (const YAML::BadFile&) {
+        cerr << "error: cannot open " << filename << endl;
+        exit(EXIT_FAILURE);
+    } catch (const YAML::ParserException& err) {
+        cerr << filename << ": " << err.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// parse keys like `cache[0].size`, `cache[*].associativity` or `alu_cycles.mul`
+static vector<PathStep> parse_path(const string& name)
+{
+    vector<PathStep> path;
+    istringstream in(name);
+    string part;
+    while (getline(in, part, '.')) {
+        PathStep step = {part, INDEX_NONE};
+        size_t bracket = part.find('[');
+        if (bracket != string::npos) {
+            string index = part.substr(bracket + 1);
+            step.key = part.substr(0, bracket);
+            if (index == "*]") {
+                step.index = INDEX_ALL;
+            } else if (index.size() >= 2 && index.back() == ']' &&
+                index.find_first_not_of("0123456789") == index.size() - 1) {
+                step.index = stoi(index);
+            } else {
+                step.key = "";
+            }
+        }
+        if (step.key.empty()) {
+            cerr << "error: bad sweep key `" << name << "`" << endl;
+            exit(EXIT_FAILURE);
+        }
+        path.push_back(step);
+    }
+    return path;
+}
+
+// set the key at `key.path[step..]` below `node` to `value`
+static void set_key(YAML::Node node, const GridKey& key, size_t step, const string& value)
+{
+    const PathStep& s = key.path[step];
+    bool last = step + 1 == key.path.size();
+    if (!node.IsMap()) {
+        cerr << "error: sweep key `" << key.name << "` does not match the configuration" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (s.index == INDEX_NONE) {
+        if (last)
+            node[s.key] = value;
+        else if (!node[s.key])
+            node[s.key] = YAML::Node(YAML::NodeType::Map);
+        if (!last)
+            set_key(node[s.key], key, step + 1, value);
+        return;
+    }
+
+    YAML::Node list = node[s.key];
+    if (!list.IsSequence() || (s.index != INDEX_ALL && (size_t)s.index >= list.size())) {
+        cerr << "error: sweep key `" << key.name << "` does not match the configuration" << endl;
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < list.size(); i++) {
+        if (s.index != INDEX_ALL && (size_t)s.index != i)
+            continue;
+        if (last)
+            list[i] = value;
+        else
+            set_key(list[i], key, step + 1, value);
+    }
+}
+
+/**
+ *  Build a job for every listed configuration file (or the configuration
+ *  given by -c) times every point of the grid. The configurations are
+ *  cloned, since YAML nodes must not be shared between the threads.
+ */
+static vector<SweepJob> make_jobs(const YAML::Node& sweep, const string& config_filename,
+    const YAML::Node& config, const YAML::Node& option)
+{
+    vector<pair<string, YAML::Node>> bases;
+    if (sweep["configs"]) {
+        for (const auto &filename: sweep["configs"])
+            bases.push_back({filename.as<string>(), load_config(filename.as<string>())});
+    } else {
+        bases.push_back({config_filename, config});
+    }
+
+    vector<GridKey> grid;
+    if (sweep["grid"]) {
+        for (const auto &pr: sweep["grid"]) {
+            GridKey key;
+            key.name = pr.first.as<string>();
+            key.path = parse_path(key.name);
+            for (const auto &value: pr.second) {
+                if (!value.IsScalar()) {
+                    cerr << "error: the values of sweep key `" << key.name << "` must be scalars" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                key.values.push_back(value.Scalar());
+            }
+            if (!pr.second.IsSequence() || key.values.empty()) {
+                cerr << "error: sweep key `" << key.name << "` needs a list of values" << endl;
+                exit(EXIT_FAILURE);
+            }
+            grid.push_back(key);
+        }
+    }
+
+    vector<SweepJob> jobs;
+    for (const auto &base: bases) {
+        // odometer over the values of the grid keys
+        vector<size_t> choice(grid.size(), 0);
+        while (true) {
+            SweepJob job;
+            job.config_name = base.first;
+            job.config = YAML::Clone(base.second);
+            for (size_t k = 0; k < grid.size(); k++) {
+                job.values.push_back(grid[k].values[choice[k]]);
+                set_key(job.config, grid[k], 0, grid[k].values[choice[k]]);
+            }
+            job.option = YAML::Clone(option);
+            job.option["quiet"] = true;
+            jobs.push_back(job);
+
+            size_t k = 0;
+            for (; k < grid.size(); k++) {
+                if (++choice[k] < grid[k].values.size())
+                    break;
+                choice[k] = 0;
+            }
+            if (k == grid.size())
+                break;
+        }
+    }
+    return jobs;
+}
+
+static Field number(double value)
+{
+    if (!isfinite(value))
+        return {"", true};
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.6g", value);
+    return {buf, true};
+}
+
+static Field number(size_t value)
+{
+    return {to_string(value), true};
+}
+
+static Row make_row(const SweepJob& job, const vector<GridKey>& grid)
+{
+    Row row;
+    const SimResult& r = job.result;
+    const SimStats& st = r.stats;
+    row["config"] = {job.config_name, false};
+    for (size_t k = 0; k < grid.size(); k++)
+        row[grid[k].name] = {job.values[k], false};
+    if (r.exited)
+        row["exit_status"] = number((size_t)r.status);
+    else
+        row["error"] = {r.error, false};
+    row["instructions"] = number(st.instruction_count);
+    row["cycles"] = number(st.tick);
+    row["CPI"] = number((double)st.tick / st.instruction_count);
+    row["fast_forwarded_instructions"] = number(r.fast_forwarded_count);
+    row["branch_predictor_name"] = {r.branch_predictor, false};
+    row["total_branch"] = number(st.total_branch);
+    row["branch_accuracy"] = number((double)st.correct_branch / st.total_branch);
+    row["mispredicted_time"] = number(st.mispredicted_time);
+    row["meet_jalr_time"] = number(st.meet_jalr_time);
+    row["data_dependent_time"] = number(st.data_dependent_time);
+    row["AMAT"] = number((double)st.mem.total_memory_access_cycles / st.mem.memory_access_num);
+    for (size_t c = 0; c < r.cache_names.size(); c++) {
+        const string& name = r.cache_names[c];
+        uint64_t hit = st.mem.hit_num[c], miss = st.mem.miss_num[c];
+        row[name + ".hit"] = number((size_t)hit);
+        row[name + ".miss"] = number((size_t)miss);
+        row[name + ".miss_rate"] = number((double)miss / (hit + miss));
+    }
+    return row;
+}
+
+static string csv_escape(const string& s)
+{
+    if (s.find_first_of(",\"\n") == string::npos)
+        return s;
+    string ret = "\"";
+    for (char c: s) {
+        if (c == '"')
+            ret += '"';
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+static string json_escape(const string& s)
+{
+    string ret = "\"";
+    for (char c: s) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            ret += buf;
+        } else {
+            ret += c;
+        }
+    }
+    return ret + "\"";
+}
+
+static void write_results(const string& filename, const vector<string>& columns,
+    const vector<Row>& rows)
+{
+    ofstream f(filename);
+    if (!f) {
+        cerr << "error: cannot open " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+    bool json = filename.size() >= 5 && filename.substr(filename.size() - 5) == ".json";
+    if (json) {
+        f << "[" << endl;
+        for (size_t i = 0; i < rows.size(); i++) {
+            f << "  {";
+            for (size_t j = 0; j < columns.size(); j++) {
+                auto it = rows[i].find(columns[j]);
+                f << (j ? ", " : "") << json_escape(columns[j]) << ": ";
+                if (it == rows[i].end() || (it->second.number && it->second.text.empty()))
+                    f << "null";
+                else
+                    f << (it->second.number ? it->second.text : json_escape(it->second.text));
+            }
+            f << "}" << (i + 1 < rows.size() ? "," : "") << endl;
+        }
+        f << "]" << endl;
+    } else {
+        for (size_t j = 0; j < columns.size(); j++)
+            f << (j ? "," : "") << csv_escape(columns[j]);
+        f << endl;
+        for (const auto &row: rows) {
+            for (size_t j = 0; j < columns.size(); j++) {
+                auto it = row.find(columns[j]);
+                f << (j ? "," : "") << (it == row.end() ? "" : csv_escape(it->second.text));
+            }
+            f << endl;
+        }
+    }
+}
+
+void run_sweep(const string& sweep_file, const string& config_filename,
+    const YAML::Node& config, const YAML::Node& option, const ArgumentVector& args)
+{
+    if (option["single_step"] || option["verbose"] || option["simpoint_profile"] ||
+        option["simpoints"] || option["smarts"] || option["save_checkpoint"]) {
+        cerr << "error: --sweep cannot be combined with -s, -v, --simpoint-profile, "
+            "--simpoints, --smarts or --save-checkpoint" << endl;
+        exit(EXIT_FAILURE);
+    }
+    YAML::Node sweep = load_config(sweep_file);
+    string output = sweep["output"].as<string>("sweep.csv");
+    unsigned threads = sweep["threads"].as<unsigned>(0);
+    if (threads == 0)
+        threads = max(thread::hardware_concurrency(), 1U);
+
+    vector<SweepJob> jobs = make_jobs(sweep, config_filename, config, option);
+    vector<GridKey> grid;
+    if (sweep["grid"])
+        for (const auto &pr: sweep["grid"])
+            grid.push_back({pr.first.as<string>(), {}, {}});
+
+    // every run reads the same input, a terminal is not read at all
+    string input;
+    if (!isatty(STDIN_FILENO)) {
+        stringstream buf;
+        buf << cin.rdbuf();
+        input = buf.str();
+    }
+
+    // the threads take the next job until none is left
+    atomic<size_t> next(0), finished(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < jobs.size(); ) {
+            // a bad configuration fails its own row, not the sweep
+            try {
+                Simulator simulator(jobs[i].option, jobs[i].config, ArgumentVector(args));
+                istringstream in(input);
+                jobs[i].result = simulator.run_quiet(in);
+            } catch (const ConfigError& err) {
+                jobs[i].result.error = string("config error: ") + err.what();
+            } catch (const YAML::Exception& err) {
+                jobs[i].result.error = string("config error: ") + err.what();
+            } catch (const runtime_error& err) {
+                jobs[i].result.error = err.what();
+            }
+            string label = jobs[i].config_name;
+            for (size_t k = 0; k < grid.size(); k++)
+                label += " " + grid[k].name + "=" + jobs[i].values[k];
+            fprintf(stderr, "[%lu/%lu] %s\n", ++finished, jobs.size(), label.c_str());
+        }
+    };
+    vector<thread> pool;
+    for (unsigned t = 0; t < min((size_t)threads, jobs.size()); t++)
+        pool.emplace_back(worker);
+    for (auto &t: pool)
+        t.join();
+
+    vector<string> columns = {"config"};
+    for (const auto &key: grid)
+        columns.push_back(key.name);
+    columns.insert(columns.end(), {"exit_status", "error", "instructions", "cycles", "CPI",
+        "fast_forwarded_instructions", "branch_predictor_name", "total_branch", "branch_accuracy",
+        "mispredicted_time", "meet_jalr_time", "data_dependent_time", "AMAT"});
+    // the caches may differ between the configurations
+    vector<string> cache_names;
+    vector<Row> rows;
+    for (const auto &job: jobs) {
+        rows.push_back(make_row(job, grid));
+        for (const auto &name: job.result.cache_names)
+            if (find(cache_names.begin(), cache_names.end(), name) == cache_names.end())
+                cache_names.push_back(name);
+    }
+    for (const auto &name: cache_names)
+        columns.insert(columns.end(), {name + ".hit", name + ".miss", name + ".miss_rate"});
+
+    write_results(output, columns, rows);
+    printf("%lu configurations simulated on %u threads, results written to %s\n",
+        jobs.size(), min((unsigned)jobs.size(), threads), output.c_str());
+}
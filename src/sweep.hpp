@@ -0,0 +1,18 @@
+#ifndef SWEEP_HPP
+#define SWEEP_HPP
+
+#include <string>
+#include <yaml-cpp/yaml.h>
+#include "simulator.hpp"
+
+/**
+ *  Simulate one ELF file under many configurations at the same time, with
+ *  one Simulator per thread, and write one row of results per configuration
+ *  to a CSV or JSON file. The sweep file lists the configuration files to
+ *  run, and/or a grid of values for configuration keys applied to each of
+ *  them (or to `config` if no file is listed).
+ */
+void run_sweep(const std::string& sweep_file, const std::string& config_filename,
+    const YAML::Node& config, const YAML::Node& option, const ArgumentVector& args);
+
+#endif
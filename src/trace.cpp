@@ -0,0 +1,197 @@
+#include <cctype>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.hpp"
+using namespace std;
+
+TraceWriter::TraceWriter(const string& filename, bool record_pc)
+    : filename(filename), record_pc(record_pc), last_addr(), last_pc(0),
+    pending(nullptr), spare(nullptr), pending_size(0), stopping(false), failed(false)
+{
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+        throw runtime_error("cannot open " + filename);
+    uint32_t version = TRACE_VERSION, flags = record_pc ? TRACE_HAS_PC : 0;
+    fwrite(TRACE_MAGIC, 1, 8, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(&flags, sizeof(flags), 1, file);
+
+    current = pos = new uint8_t[BUFFER_SIZE];
+    end = current + BUFFER_SIZE;
+    writer = thread(&TraceWriter::write_loop, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    flush_buffer();
+    {
+        unique_lock<mutex> guard(lock);
+        cond.wait(guard, [this] { return pending == nullptr; });
+        stopping = true;
+    }
+    cond.notify_all();
+    writer.join();
+    if (fclose(file) != 0 || failed)
+        cerr << "warning: failed to write the trace to " << filename << endl;
+    delete[] current;
+    delete[] spare;
+}
+
+// hand the records in `current` to the thread, and take its free buffer
+void TraceWriter::flush_buffer()
+{
+    uint8_t *free_buffer;
+    {
+        unique_lock<mutex> guard(lock);
+        cond.wait(guard, [this] { return pending == nullptr; });
+        free_buffer = spare;
+        spare = nullptr;
+        pending = current;
+        pending_size = pos - current;
+    }
+    cond.notify_all();
+    current = pos = free_buffer ? free_buffer : new uint8_t[BUFFER_SIZE];
+    end = current + BUFFER_SIZE;
+}
+
+void TraceWriter::write_loop()
+{
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        cond.wait(guard, [this] { return pending != nullptr || stopping; });
+        if (!pending)
+            return;
+        uint8_t *buffer = pending;
+        size_t size = pending_size;
+        guard.unlock();
+        if (fwrite(buffer, 1, size, file) != size)
+            failed = true;
+        guard.lock();
+        pending = nullptr;
+        spare = buffer;
+        cond.notify_all();
+    }
+}
+
+TraceReader::TraceReader(const string& filename)
+    : filename(filename), data(nullptr), length(0), binary(false), has_pc(false), last_addr(), last_pc(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        cerr << "error: cannot open " << filename << endl;
+        exit(EXIT_FAILURE);
+    }
+    length = st.st_size;
+    if (length) {
+        void *addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            cerr << "error: cannot map " << filename << ": " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        data = (const uint8_t*)addr;
+        madvise(addr, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    pos = data;
+    end = data + length;
+
+    if (length >= 8 && memcmp(data, TRACE_MAGIC, 8) == 0) {
+        uint32_t header[2];
+        if (length < 8 + sizeof(header)) {
+            cerr << "error: " << filename << ": unsupported trace version" << endl;
+            exit(EXIT_FAILURE);
+        }
+        memcpy(header, data + 8, sizeof(header));
+        if (header[0] != TRACE_VERSION) {
+            cerr << "error: " << filename << ": unsupported trace version" << endl;
+            exit(EXIT_FAILURE);
+        }
+        binary = true;
+        has_pc = header[1] & TRACE_HAS_PC;
+        pos += 8 + sizeof(header);
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    if (data)
+        munmap((void*)data, length);
+}
+
+void TraceReader::corrupted() const
+{
+    cerr << "error: " << filename << ": corrupted trace" << endl;
+    exit(EXIT_FAILURE);
+}
+
+// a line is `r` or `w` and the address, which is parsed like stoull with base 0
+bool TraceReader::next_text(TraceKind& kind, uint64_t& addr, int& bytes)
+{
+    while (pos < end && isspace(*pos))
+        pos++;
+    if (pos == end)
+        return false;
+    const uint8_t *action = pos;
+    while (pos < end && !isspace(*pos))
+        pos++;
+    size_t action_len = pos - action;
+    while (pos < end && isspace(*pos))
+        pos++;
+    const uint8_t *number = pos;
+    while (pos < end && !isspace(*pos))
+        pos++;
+    if (number == pos)  // a line without address is ignored, as before
+        return false;
+
+    if (action_len == 1 && *action == 'r') {
+        kind = TRACE_READ;
+    } else if (action_len == 1 && *action == 'w') {
+        kind = TRACE_WRITE;
+    } else {
+        cerr << "invalid action: " << string(action, action + action_len) << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const uint8_t *p = number;
+    int base = 10;
+    if (p + 1 < pos && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (p + 1 < pos && p[0] == '0') {
+        base = 8;
+    }
+    addr = 0;
+    const uint8_t *digits = p;
+    for (; p < pos; p++) {
+        int d = isdigit(*p) ? *p - '0' : isxdigit(*p) ? tolower(*p) - 'a' + 10 : base;
+        if (d >= base)
+            break;
+        addr = addr * base + d;
+    }
+    // like stoull, trailing characters after some digits are ignored
+    if (p == digits) {
+        cerr << "invalid address: " << string(number, pos) << endl;
+        exit(EXIT_FAILURE);
+    }
+    bytes = 1;
+    return true;
+}
+
+void convert_trace(const string& text_file, const string& binary_file)
+{
+    TraceReader reader(text_file);
+    TraceWriter writer(binary_file, false);
+    TraceKind kind;
+    uint64_t addr;
+    int bytes;
+    size_t count = 0;
+    while (reader.next(kind, addr, bytes)) {
+        writer.record(kind, addr, bytes, 0);
+        count++;
+    }
+    printf("%lu accesses converted to %s\n", count, binary_file.c_str());
+}
@@ -0,0 +1,166 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "types.hpp"
+
+/**
+ *  Binary traces start with the magic, a uint32 version and uint32 flags.
+ *  Each record is a byte holding the kind and log2 of the size, then the
+ *  address as a zigzag varint delta from the last address of the same
+ *  kind, then with TRACE_HAS_PC the pc of a data access as a delta from the
+ *  last pc (the address of an instruction fetch is its pc).
+ */
+#define TRACE_MAGIC     "RVTRACE\0"
+#define TRACE_VERSION   1
+#define TRACE_HAS_PC    0x1
+
+#define TRACE_MAX_RECORD    21  // a byte and two varints
+
+enum TraceKind
+{
+    TRACE_INST,
+    TRACE_READ,
+    TRACE_WRITE,
+    TRACE_KINDS
+};
+
+static inline uint8_t* put_varint(uint8_t *p, uint64_t x)
+{
+    while (x >= 0x80) {
+        *p++ = (uint8_t)x | 0x80;
+        x >>= 7;
+    }
+    *p++ = (uint8_t)x;
+    return p;
+}
+
+static inline uint64_t zigzag(int64_t x)
+{
+    return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+/**
+ *  Writes the accesses of the memory system to a binary trace. Records are
+ *  encoded into a buffer, and full buffers are handed to a thread that
+ *  writes them to the file, so the simulation only waits for the disk when
+ *  it produces faster than the disk takes.
+ */
+class TraceWriter
+{
+private:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    FILE *file;
+    std::string filename;
+    bool record_pc;
+    uint64_t last_addr[TRACE_KINDS];
+    uint64_t last_pc;
+
+    // `current` is filled by the simulation, `pending` waits for the thread,
+    // and `spare` has been written by it
+    uint8_t *current, *pos, *end;
+    uint8_t *pending, *spare;
+    size_t pending_size;
+    bool stopping, failed;
+    std::mutex lock;
+    std::condition_variable cond;
+    std::thread writer;
+
+    void flush_buffer();
+    void write_loop();
+
+public:
+    TraceWriter(const std::string& filename, bool record_pc);
+    ~TraceWriter();
+
+    inline void record(TraceKind kind, uint64_t addr, int bytes, uint64_t pc)
+    {
+        if (end - pos < TRACE_MAX_RECORD)
+            flush_buffer();
+        *pos++ = kind | (bytes == 8 ? 3 : bytes == 4 ? 2 : bytes == 2 ? 1 : 0) << 2;
+        pos = put_varint(pos, zigzag(addr - last_addr[kind]));
+        last_addr[kind] = addr;
+        if (!record_pc)
+            return;
+        if (kind != TRACE_INST)
+            pos = put_varint(pos, zigzag(pc - last_pc));
+        last_pc = pc;
+    }
+};
+
+/**
+ *  Reads a text or binary trace, telling them apart by the header. The
+ *  file is mapped into memory and decoded in place, so reading a record
+ *  allocates nothing. Records of text traces are 1 byte reads or writes.
+ */
+class TraceReader
+{
+private:
+    std::string filename;
+    const uint8_t *data, *pos, *end;
+    size_t length;
+    bool binary, has_pc;
+    uint64_t last_addr[TRACE_KINDS];
+    uint64_t last_pc;
+
+    bool next_text(TraceKind& kind, uint64_t& addr, int& bytes);
+    [[noreturn]] void corrupted() const;
+
+    inline bool get_varint(uint64_t& x)
+    {
+        x = 0;
+        for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+            uint8_t c = *pos++;
+            x |= (uint64_t)(c & 0x7F) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+public:
+    TraceReader(const std::string& filename);
+    ~TraceReader();
+
+    // read the next record, return false at the end of the trace
+    inline bool next(TraceKind& kind, uint64_t& addr, int& bytes)
+    {
+        uint64_t pc;
+        return next(kind, addr, bytes, pc);
+    }
+
+    // also the pc of the access, 0 for data accesses of traces without pc
+    inline bool next(TraceKind& kind, uint64_t& addr, int& bytes, uint64_t& pc)
+    {
+        if (!binary) {
+            pc = 0;
+            return next_text(kind, addr, bytes);
+        }
+        if (pos == end)
+            return false;
+        uint8_t c = *pos++;
+        uint64_t delta, pc_delta = 0;
+        kind = (TraceKind)(c & 3);
+        if (kind >= TRACE_KINDS || !get_varint(delta) ||
+            (has_pc && kind != TRACE_INST && !get_varint(pc_delta)))
+            corrupted();
+        addr = last_addr[kind] += (delta >> 1) ^ -(delta & 1);
+        bytes = 1 << ((c >> 2) & 3);
+        if (kind == TRACE_INST)
+            last_pc = addr;
+        else if (has_pc)
+            last_pc += (pc_delta >> 1) ^ -(pc_delta & 1);
+        pc = kind == TRACE_INST || has_pc ? last_pc : 0;
+        return true;
+    }
+};
+
+// convert a text trace to the binary format
+void convert_trace(const std::string& text_file, const std::string& binary_file);
+
+#endif
@@ -33,4 +33,10 @@ static inline void throw_error(const char* __restrict format, Args... args)
     throw std::runtime_error(msg);
 }
 
+// a configuration that cannot be simulated, thrown by the constructors
+struct ConfigError : public std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
 #endif